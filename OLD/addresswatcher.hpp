@@ -0,0 +1,73 @@
+// Tells when the IPv4 addresses of the Pi change, so the address the bridge reports can be kept instead of looked up
+//
+// Listens on a netlink route socket for new and removed addresses. Hand fd() to a poll/epoll loop and call dispatch()
+// when it is readable, it drains the notifications and returns whether there were any.
+
+#ifndef ADDRESSWATCHER_HPP
+#define ADDRESSWATCHER_HPP
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+
+class AddressWatcher
+{
+public:
+    AddressWatcher()
+    {
+        netlinkFd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+        struct sockaddr_nl address;
+        std::memset(&address, 0, sizeof(address));
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = RTMGRP_IPV4_IFADDR;
+        if (netlinkFd >= 0 && bind(netlinkFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0)
+        {
+            close(netlinkFd);
+            netlinkFd = -1;
+        }
+        if (netlinkFd < 0)
+        {
+            std::cerr << "Unable to watch the network addresses, the reported IP is only looked up at startup." << std::endl;
+        }
+    }
+
+    ~AddressWatcher()
+    {
+        if (netlinkFd >= 0)
+            close(netlinkFd);
+    }
+
+    AddressWatcher(const AddressWatcher &) = delete;
+    AddressWatcher &operator=(const AddressWatcher &) = delete;
+
+    // Descriptor that becomes readable when an address was added or removed, -1 when netlink is not available
+    int fd() const
+    {
+        return netlinkFd;
+    }
+
+    // Read all pending notifications, true when an address changed since the last call
+    bool dispatch()
+    {
+        bool changed = false;
+        ssize_t length;
+        while ((length = recv(netlinkFd, buffer, sizeof(buffer), 0)) > 0)
+        {
+            for (struct nlmsghdr *header = reinterpret_cast<struct nlmsghdr *>(buffer); NLMSG_OK(header, length); header = NLMSG_NEXT(header, length))
+            {
+                if (header->nlmsg_type == RTM_NEWADDR || header->nlmsg_type == RTM_DELADDR)
+                    changed = true;
+            }
+        }
+        return changed;
+    }
+
+private:
+    int netlinkFd = -1;
+    alignas(struct nlmsghdr) char buffer[4096];
+};
+
+#endif
@@ -0,0 +1,64 @@
+// g++ -o benchcameras benchcameras.cpp `pkg-config --cflags --libs opencv4` -std=c++14 -pthread -O2 -march=native
+//
+// Runs several webcams through one network with MultiCameraHandler, a batch per forward pass, to see what N cameras
+// cost next to one. Prints the frames captured, dropped and processed per second, the faces found per camera and the
+// latency per stage.
+//
+// ./benchcameras seconds index...      e.g. ./benchcameras 60 0 2
+
+#define HERKEN_NO_MAIN
+#include "herken.cpp"
+
+// Only counts, printing every frame would be what gets measured
+class CountingCameraHandler : public MultiCameraHandler
+{
+public:
+    std::vector<uint64_t> faceCounts;
+
+    CountingCameraHandler(const std::vector<int> &camIndices, std::unique_ptr<IYoloModel> model)
+        : MultiCameraHandler(camIndices, std::move(model)), faceCounts(camIndices.size(), 0)
+    {
+    }
+
+    void processDetections(size_t camera, Mat & /*frame*/, const std::vector<cv::Rect> &faces) override
+    {
+        faceCounts[camera] += faces.size();
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: " << argv[0] << " seconds index..." << endl;
+        return -1;
+    }
+    int seconds = std::atoi(argv[1]);
+    std::vector<int> camIndices;
+    for (int i = 2; i < argc; ++i)
+        camIndices.push_back(std::atoi(argv[i]));
+
+    auto yoloModel = std::make_unique<YoloModelV4>();
+    yoloModel->loadModel(YOLO4CONFIG, YOLO4WEIGHTS);
+    yoloModel->warmUp();
+
+    CountingCameraHandler cameras(camIndices, std::move(yoloModel));
+    // The warm up above is left out of the latency
+    LatencyReport latency;
+    std::thread timer([&cameras, seconds]
+                      {
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        cameras.stop(); });
+    cameras.captureAndProcess();
+    timer.join();
+
+    PipelineStats stats = cameras.getStats();
+    cout << camIndices.size() << " cameras: " << stats.framesCaptured / (double)seconds << " fps captured, "
+         << stats.framesDropped / (double)seconds << " dropped, " << stats.framesProcessed / (double)seconds << " processed" << endl;
+    for (size_t i = 0; i < camIndices.size(); ++i)
+    {
+        cout << "Camera " << camIndices[i] << ": " << cameras.faceCounts[i] << " faces" << endl;
+    }
+    cout << latency.make() << endl;
+    return 0;
+}
@@ -0,0 +1,214 @@
+// g++ -o benchdecode benchdecode.cpp `pkg-config --cflags --libs opencv4` -std=c++14 -O2 -march=native
+//
+// Micro-benchmark of the YOLO output decoder in yolodecode.hpp against the scalar loop herken.cpp used before.
+//
+// ./benchdecode                                                  run on synthetic tensors shaped like the yolov4-tiny-3l head
+// ./benchdecode outputs.yml.gz                                   run on tensors recorded with --record
+// ./benchdecode --record cfg weights input outputs.yml.gz [size]  record the raw network outputs for an image or video
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "yolodecode.hpp"
+
+#define CONFIDENCETHRESHOLD 0.5f
+#define ITERATIONS 2000
+
+using namespace cv;
+using namespace std;
+
+// One frame worth of network outputs
+typedef vector<Mat> Tensors;
+
+// The per row loop from herken.cpp before the bulk decoder, kept as the reference
+void referenceDecode(const Tensors &outs, const LetterboxInfo &letterbox, Size frameSize, float confidenceThreshold,
+                     vector<Rect> &boxes, vector<float> &confidences)
+{
+    for (size_t i = 0; i < outs.size(); ++i)
+    {
+        float *data = (float *)outs[i].data;
+        for (int j = 0; j < outs[i].rows; ++j, data += outs[i].cols)
+        {
+            float confidence = data[4];
+            if (confidence > confidenceThreshold)
+            {
+                int centerX = (int)((data[0] * letterbox.inputSize.width - letterbox.padX) / letterbox.scale);
+                int centerY = (int)((data[1] * letterbox.inputSize.height - letterbox.padY) / letterbox.scale);
+                int width = (int)(data[2] * letterbox.inputSize.width / letterbox.scale);
+                int height = (int)(data[3] * letterbox.inputSize.height / letterbox.scale);
+                int left = centerX - width / 2;
+                int top = centerY - height / 2;
+
+                left = std::max(0, left - EXPANSIONPIXELS);
+                top = std::max(0, top - EXPANSIONPIXELS);
+                width = std::min(frameSize.width - left, width + 2 * EXPANSIONPIXELS);
+                height = std::min(frameSize.height - top, height + 2 * EXPANSIONPIXELS);
+
+                confidences.push_back(confidence);
+                boxes.push_back(Rect(left, top, width, height));
+            }
+        }
+    }
+}
+
+// Random outputs for the three heads of yolov4-tiny-3l at 416x416, with a handful of rows above the threshold
+vector<Tensors> syntheticTensors(int frames)
+{
+    const int gridSizes[] = {13, 26, 52};
+    RNG rng(1234);
+    vector<Tensors> tensors(frames);
+    for (Tensors &outs : tensors)
+    {
+        for (int grid : gridSizes)
+        {
+            Mat out(grid * grid * 3, 6, CV_32F);
+            rng.fill(out, RNG::UNIFORM, 0.0, 1.0);
+            for (int row = 0; row < out.rows; ++row)
+            {
+                // Background rows have a tiny objectness, about one in a thousand looks like a face
+                float *data = out.ptr<float>(row);
+                data[4] = rng.uniform(0, 1000) == 0 ? rng.uniform(0.3f, 1.0f) : rng.uniform(0.0f, 0.05f);
+            }
+            outs.push_back(out);
+        }
+    }
+    return tensors;
+}
+
+vector<Tensors> loadTensors(const string &path)
+{
+    FileStorage fs(path, FileStorage::READ);
+    if (!fs.isOpened())
+    {
+        cerr << "Unable to open " << path << endl;
+        exit(-1);
+    }
+
+    vector<Tensors> tensors((int)fs["frames"]);
+    for (size_t frame = 0; frame < tensors.size(); ++frame)
+    {
+        int layers = (int)fs["layers"];
+        for (int layer = 0; layer < layers; ++layer)
+        {
+            Mat out;
+            fs["output_" + to_string(frame) + "_" + to_string(layer)] >> out;
+            tensors[frame].push_back(out);
+        }
+    }
+    return tensors;
+}
+
+// Run the real network and store its raw outputs so the benchmark sees real objectness distributions
+int record(const string &config, const string &weights, const string &input, const string &path, int size)
+{
+    dnn::Net net = dnn::readNetFromDarknet(config, weights);
+    net.setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
+    net.setPreferableTarget(dnn::DNN_TARGET_CPU);
+
+    VideoCapture cap(input);
+    FileStorage fs(path, FileStorage::WRITE);
+    if (!cap.isOpened() || !fs.isOpened())
+    {
+        cerr << "Unable to open " << input << " or " << path << endl;
+        return -1;
+    }
+
+    Mat frame, blob;
+    vector<Mat> outs;
+    int frames = 0;
+    while (cap.read(frame) && !frame.empty())
+    {
+        dnn::blobFromImage(frame, blob, 1 / 255.0, Size(size, size), Scalar(0, 0, 0), true, false);
+        net.setInput(blob);
+        net.forward(outs, net.getUnconnectedOutLayersNames());
+        for (size_t layer = 0; layer < outs.size(); ++layer)
+        {
+            fs << "output_" + to_string(frames) + "_" + to_string(layer) << outs[layer];
+        }
+        frames++;
+    }
+    fs << "frames" << frames;
+    fs << "layers" << (int)outs.size();
+    cout << "Recorded " << frames << " frames to " << path << endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 6 && string(argv[1]) == "--record")
+    {
+        return record(argv[2], argv[3], argv[4], argv[5], argc > 6 ? atoi(argv[6]) : 416);
+    }
+
+    vector<Tensors> tensors = argc > 1 ? loadTensors(argv[1]) : syntheticTensors(64);
+    if (tensors.empty())
+    {
+        cerr << "No tensors to decode" << endl;
+        return -1;
+    }
+
+    // A 1280x720 webcam frame letterboxed into 416x416
+    Size frameSize(1280, 720);
+    LetterboxInfo letterbox;
+    letterbox.inputSize = Size(416, 416);
+    letterbox.scale = 416.0f / 1280.0f;
+    letterbox.padX = 0;
+    letterbox.padY = (416 - (int)(720 * letterbox.scale)) / 2;
+
+    vector<Rect> referenceBoxes, decodedBoxes;
+    vector<float> referenceConfidences, decodedConfidences;
+    vector<int> survivors;
+    size_t rows = 0;
+    for (const Mat &out : tensors[0])
+        rows += out.rows;
+
+    // Both decoders have to agree box for box before their timings mean anything
+    for (const Tensors &outs : tensors)
+    {
+        referenceBoxes.clear();
+        referenceConfidences.clear();
+        decodedBoxes.clear();
+        decodedConfidences.clear();
+        referenceDecode(outs, letterbox, frameSize, CONFIDENCETHRESHOLD, referenceBoxes, referenceConfidences);
+        for (const Mat &out : outs)
+            decodeDarknetOutput(out, letterbox, frameSize, CONFIDENCETHRESHOLD, survivors, decodedBoxes, decodedConfidences);
+
+        if (referenceBoxes != decodedBoxes || referenceConfidences != decodedConfidences)
+        {
+            cerr << "Decoder output differs from the reference loop" << endl;
+            return -1;
+        }
+    }
+
+    int64 start = getTickCount();
+    size_t found = 0;
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        const Tensors &outs = tensors[i % tensors.size()];
+        referenceBoxes.clear();
+        referenceConfidences.clear();
+        referenceDecode(outs, letterbox, frameSize, CONFIDENCETHRESHOLD, referenceBoxes, referenceConfidences);
+        found += referenceBoxes.size();
+    }
+    double referenceMicros = (getTickCount() - start) * 1e6 / getTickFrequency() / ITERATIONS;
+
+    start = getTickCount();
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        const Tensors &outs = tensors[i % tensors.size()];
+        decodedBoxes.clear();
+        decodedConfidences.clear();
+        for (const Mat &out : outs)
+            decodeDarknetOutput(out, letterbox, frameSize, CONFIDENCETHRESHOLD, survivors, decodedBoxes, decodedConfidences);
+        found -= decodedBoxes.size();
+    }
+    double decodedMicros = (getTickCount() - start) * 1e6 / getTickFrequency() / ITERATIONS;
+
+    cout << tensors.size() << " frames, " << rows << " rows per frame, decoder built for " << YOLODECODE_SIMD << endl;
+    cout << "reference loop: " << referenceMicros << " us/frame" << endl;
+    cout << "bulk decoder:   " << decodedMicros << " us/frame (" << referenceMicros / decodedMicros << "x)" << endl;
+    return found == 0 ? 0 : -1;
+}
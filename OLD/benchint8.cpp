@@ -0,0 +1,132 @@
+// g++ -o benchint8 benchint8.cpp `pkg-config --cflags --libs opencv4` -std=c++14 -pthread -O2 -march=native
+//
+// Builds the INT8 calibration set herken uses when int8Inference is on, and compares the quantized network with the
+// FP32 yolov4-tiny-3l it replaces: how many of the FP32 faces are still found, how well the boxes line up and how fast it is.
+// OpenCV can not save a quantized network, so herken quantizes at startup from the images listed in INT8CALIBRATIONLIST.
+//
+// ./benchint8 captures/                  calibrate on the face_*.jpg in captures/ and evaluate on the rest of them
+// ./benchint8 captures/ frames/          evaluate on the images in frames/ instead
+
+#define HERKEN_NO_MAIN
+#include "herken.cpp"
+
+#define CALIBRATIONIMAGES INT8CALIBRATIONIMAGES // most images in the calibration set, spread evenly over what is there. herken uses no more on the Pi
+#define ITERATIONS 3         // times every evaluation image is run for the timing
+#define MATCHIOU 0.5         // overlap an INT8 box needs with an FP32 box to count as the same face
+
+double overlap(const cv::Rect &a, const cv::Rect &b)
+{
+    double intersection = (a & b).area();
+    return intersection / (a.area() + b.area() - intersection);
+}
+
+// Run model over all images, returns the average milliseconds per image
+double detectAll(IYoloModel &model, const vector<Mat> &images, vector<vector<Rect>> &faces)
+{
+    faces.assign(images.size(), vector<Rect>());
+    int64 start = getTickCount();
+    for (int iteration = 0; iteration < ITERATIONS; ++iteration)
+    {
+        for (size_t i = 0; i < images.size(); ++i)
+        {
+            faces[i] = model.detectFaces(images[i]);
+        }
+    }
+    return (getTickCount() - start) * 1000.0 / getTickFrequency() / ITERATIONS / images.size();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " captureDirectory [evaluationDirectory]" << endl;
+        return -1;
+    }
+
+    vector<cv::String> captures;
+    cv::glob(string(argv[1]) + "/face_*.jpg", captures, false);
+    if (captures.empty())
+    {
+        cerr << "No face_*.jpg in " << argv[1] << endl;
+        return -1;
+    }
+
+    // Every n-th capture goes into the calibration set, the others are kept apart for the evaluation
+    size_t step = std::max<size_t>(1, captures.size() / CALIBRATIONIMAGES);
+    vector<cv::String> calibrationPaths;
+    vector<cv::String> evaluationPaths;
+    for (size_t i = 0; i < captures.size(); ++i)
+    {
+        if (i % step == 0 && calibrationPaths.size() < CALIBRATIONIMAGES)
+            calibrationPaths.push_back(captures[i]);
+        else
+            evaluationPaths.push_back(captures[i]);
+    }
+    if (argc > 2)
+    {
+        cv::glob(string(argv[2]) + "/*.jpg", evaluationPaths, false);
+    }
+    if (evaluationPaths.empty())
+    {
+        evaluationPaths = calibrationPaths;
+    }
+
+    ofstream listFile(INT8CALIBRATIONLIST);
+    for (const auto &path : calibrationPaths)
+    {
+        listFile << path << "\n";
+    }
+    listFile.close();
+    cout << "Wrote " << calibrationPaths.size() << " calibration images to " << INT8CALIBRATIONLIST << endl;
+
+    vector<Mat> evaluation;
+    for (const auto &path : evaluationPaths)
+    {
+        Mat image = imread(path);
+        if (!image.empty())
+            evaluation.push_back(image);
+    }
+
+    YoloModelV4 fp32;
+    fp32.loadModel(YOLO4CONFIG, YOLO4WEIGHTS);
+    YoloModelV4 int8;
+    int8.loadModel(YOLO4CONFIG, YOLO4WEIGHTS);
+    if (!int8.useInt8(readCalibrationImages(INT8CALIBRATIONLIST)))
+    {
+        return -1;
+    }
+
+    vector<vector<Rect>> fp32Faces;
+    vector<vector<Rect>> int8Faces;
+    double fp32Millis = detectAll(fp32, evaluation, fp32Faces);
+    double int8Millis = detectAll(int8, evaluation, int8Faces);
+
+    // The FP32 detections are the reference, every one of them gets the INT8 box that overlaps it most
+    size_t referenceFaces = 0;
+    size_t quantizedFaces = 0;
+    size_t matched = 0;
+    double overlapSum = 0;
+    for (size_t i = 0; i < evaluation.size(); ++i)
+    {
+        referenceFaces += fp32Faces[i].size();
+        quantizedFaces += int8Faces[i].size();
+        for (const Rect &reference : fp32Faces[i])
+        {
+            double best = 0;
+            for (const Rect &face : int8Faces[i])
+                best = std::max(best, overlap(reference, face));
+            if (best >= MATCHIOU)
+            {
+                matched++;
+                overlapSum += best;
+            }
+        }
+    }
+
+    cout << evaluation.size() << " evaluation images" << endl;
+    cout << "FP32: " << referenceFaces << " faces, " << fp32Millis << " ms/image" << endl;
+    cout << "INT8: " << quantizedFaces << " faces, " << int8Millis << " ms/image (" << fp32Millis / int8Millis << "x)" << endl;
+    cout << "FP32 faces found by INT8: " << matched << "/" << referenceFaces << " ("
+         << (referenceFaces ? 100.0 * matched / referenceFaces : 100.0) << "%), mean IoU of those " << (matched ? overlapSum / matched : 0) << endl;
+    return 0;
+}
@@ -0,0 +1,65 @@
+// g++ -o benchmodels benchmodels.cpp `pkg-config --cflags --libs opencv4` -std=c++14 -pthread -O2 -march=native
+//
+// Runs yolov4-tiny-3l and yolov8n-face over the same frames, to see which one is worth running on the Pi.
+// Both go through the same letterboxing, decoding and NMS as in herken.
+//
+// ./benchmodels input [v8model.onnx]      input is anything VideoCapture opens: a video, an image, img_%03d.jpg
+
+#define HERKEN_NO_MAIN
+#include "herken.cpp"
+
+#define MAXFRAMES 200
+#define WARMUPFRAMES 3 // the first forward calls set up the network, they are not timed
+
+struct ModelResult
+{
+    double millis = 0;
+    size_t faces = 0;
+};
+
+ModelResult run(IYoloModel &model, const vector<Mat> &frames)
+{
+    ModelResult result;
+    for (int i = 0; i < WARMUPFRAMES && i < (int)frames.size(); ++i)
+        model.detectFaces(frames[i]);
+
+    vector<Rect> faces(MAXFACES);
+    int64 start = getTickCount();
+    for (const Mat &frame : frames)
+        result.faces += model.detectFaces(frame, faces.data(), faces.size());
+    result.millis = (getTickCount() - start) * 1000.0 / getTickFrequency() / frames.size();
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " input [v8model.onnx]" << endl;
+        return -1;
+    }
+
+    VideoCapture input(argv[1]);
+    vector<Mat> frames;
+    Mat frame;
+    while (frames.size() < MAXFRAMES && input.read(frame) && !frame.empty())
+        frames.push_back(frame.clone());
+    if (frames.empty())
+    {
+        cerr << "No frames in " << argv[1] << endl;
+        return -1;
+    }
+
+    YoloModelV4 v4;
+    v4.loadModel(YOLO4CONFIG, YOLO4WEIGHTS);
+    YoloModelV8 v8;
+    v8.loadModel(argc > 2 ? argv[2] : "models/yolov8n-face.onnx", "");
+
+    ModelResult v4Result = run(v4, frames);
+    ModelResult v8Result = run(v8, frames);
+
+    cout << frames.size() << " frames of " << frames[0].cols << "x" << frames[0].rows << endl;
+    cout << "yolov4-tiny-3l: " << v4Result.millis << " ms/frame, " << v4Result.faces << " faces" << endl;
+    cout << "yolov8n-face:   " << v8Result.millis << " ms/frame, " << v8Result.faces << " faces" << endl;
+    return 0;
+}
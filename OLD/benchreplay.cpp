@@ -0,0 +1,196 @@
+// g++ -o benchreplay benchreplay.cpp `pkg-config --cflags --libs opencv4` -std=c++14 -pthread -O2 -march=native
+//
+// Plays a recording through herken's detector, the same threads, state machine, tracker, motion gate, region detection
+// and capture window a game runs, for every model, input size and OpenCV thread count below. Writes the FPS, dropped
+// frames, per stage latency, face counts and finished games of every run to JSON. Run it on the Pi before deploying and
+// compare the report with the previous one, a slower stage shows up right away. The captured faces are written as
+// benchreplay_face_N.jpg in the working directory.
+//
+// ./benchreplay input [report.json]        input is a video, an img_%04d.jpg pattern or a directory of frames
+
+#define HERKEN_NO_MAIN
+#include "herken.cpp"
+
+#define REPLAYFPS 30                          // the rate of the webcam, 0 to push the frames through as fast as they are processed
+#define INPUTSIZES {320, 416, 640}            // Presence input widths, the height follows the 2:1 frame. 0 keeps the size of the cfg
+#define THREADCOUNTS {1, 2, 4}                // cv::setNumThreads for the network
+#define REPLAYPLAYERS 2                       // players every replayed game is started with, the number of people in the recording
+#define YOLO8MODEL "models/yolov8n-face.onnx" // left out when it is not there
+
+// Plays the bridge for a replayed game: starts one with REPLAYPLAYERS players, and every time the detector posts
+// scanningComplete says the images are done and starts the next one, so the whole recording goes through the state machine
+class ReplayGame
+{
+public:
+    std::atomic<uint64_t> rounds{0}; // games the detector finished
+
+    explicit ReplayGame(GameChannel &channel) : channel(channel)
+    {
+        start();
+        worker = std::thread(&ReplayGame::run, this);
+    }
+
+    ~ReplayGame()
+    {
+        stopping = true;
+        channel.post(0);
+        worker.join();
+    }
+
+    ReplayGame(const ReplayGame &) = delete;
+    ReplayGame &operator=(const ReplayGame &) = delete;
+
+private:
+    GameChannel &channel;
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+
+    void start()
+    {
+        GameStateSnapshot state;
+        state.numberPlayers = REPLAYPLAYERS;
+        state.gameStart = 1;
+        channel.game.store(state);
+    }
+
+    // Everything else the detector posts is swallowed
+    void run()
+    {
+        struct pollfd fds = {channel.fd(), POLLIN, 0};
+        while (!stopping)
+        {
+            if (poll(&fds, 1, -1) <= 0 || !(channel.take() & SCANNINGCOMPLETE))
+                continue;
+            rounds++;
+            channel.game.update([](GameStateSnapshot &state)
+                                { state.done = 1; });
+            // The detector resets the state itself once it saw done, the next game can only start after that
+            GameStateSnapshot state = channel.game.waitUntil([](const GameStateSnapshot &snapshot)
+                                                          { return snapshot.gameStart == 0; });
+            // Still started when the waiting ended because the detector stopped
+            if (state.gameStart != 0)
+                return;
+            start();
+        }
+    }
+};
+
+// herken's detector as it runs in a game, only counting the faces it sees along the way
+class ReplayHandler : public FaceRecognitionHandler
+{
+public:
+    uint64_t faceCount = 0;
+    uint64_t framesWithFaces = 0;
+
+    ReplayHandler(std::unique_ptr<IYoloModel> model, GameChannel &channel, const CaptureConfig &config)
+        : FaceRecognitionHandler(-1, std::move(model), channel, config)
+    {
+        facePrefix = "benchreplay_";
+    }
+
+    void processFrame(Mat &frame) override
+    {
+        // Only the Armed and Capturing frames look for faces, the ones around a game start or done do not count
+        bool looking = detectorState == DetectorState::Armed || detectorState == DetectorState::Capturing;
+        FaceRecognitionHandler::processFrame(frame);
+        if (looking)
+        {
+            faceCount += faces.size();
+            if (!faces.empty())
+                framesWithFaces++;
+        }
+    }
+};
+
+std::unique_ptr<IYoloModel> loadModel(const std::string &name)
+{
+    std::unique_ptr<IYoloModel> model;
+    if (name == "yolov8n-face")
+    {
+        model.reset(new YoloModelV8());
+        model->loadModel(YOLO8MODEL, "");
+    }
+    else
+    {
+        model.reset(new YoloModelV4());
+        model->loadModel(YOLO4CONFIG, YOLO4WEIGHTS);
+    }
+    return model;
+}
+
+// One run of the recording, as a JSON object
+std::string run(const std::string &input, const std::string &modelName, int inputWidth, int threads)
+{
+    cv::setNumThreads(threads);
+    std::unique_ptr<IYoloModel> model = loadModel(modelName);
+    if (inputWidth > 0 && modelName != "yolov8n-face")
+        model->setInputSize(cv::Size(inputWidth, inputWidth / 2));
+    model->warmUp();
+
+    CaptureConfig config;
+    config.backend = CaptureBackend::Replay;
+    config.device = input;
+    config.fps = REPLAYFPS;
+    GameChannel channel;
+    ReplayGame game(channel);
+    ReplayHandler handler(std::move(model), channel, config);
+
+    // Only what happens during this run ends up in the report, the warm up above is left out
+    LatencyReport latency;
+    int64 start = getTickCount();
+    handler.captureAndProcess();
+    double seconds = (getTickCount() - start) / getTickFrequency();
+    PipelineStats stats = handler.getStats();
+
+    std::cout << modelName << " " << inputWidth << " wide on " << threads << " threads: " << stats.framesProcessed / seconds
+              << " fps, " << stats.framesDropped << "/" << stats.framesCaptured << " frames dropped, " << handler.faceCount << " faces, "
+              << game.rounds.load() << " games" << std::endl;
+
+    std::ostringstream json;
+    json << "{\"model\":\"" << modelName << "\",\"inputWidth\":" << inputWidth << ",\"threads\":" << threads
+         << ",\"seconds\":" << seconds << ",\"fps\":" << stats.framesProcessed / seconds
+         << ",\"framesCaptured\":" << stats.framesCaptured << ",\"framesDropped\":" << stats.framesDropped
+         << ",\"framesProcessed\":" << stats.framesProcessed << ",\"faces\":" << handler.faceCount
+         << ",\"framesWithFaces\":" << handler.framesWithFaces << ",\"games\":" << game.rounds.load()
+         << ",\"latency\":" << latency.make() << "}";
+    return json.str();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " input [report.json]" << endl;
+        return -1;
+    }
+    std::string reportPath = argc > 2 ? argv[2] : "benchreplay.json";
+
+    vector<std::string> models = {"yolov4-tiny-3l"};
+    if (fileTime(YOLO8MODEL) != 0)
+        models.push_back("yolov8n-face");
+
+    vector<std::string> runs;
+    for (const auto &modelName : models)
+    {
+        for (int inputWidth : INPUTSIZES)
+        {
+            // YOLOv8 only runs at the 640x640 it was exported for
+            if (modelName == "yolov8n-face" && inputWidth != 640)
+                continue;
+            for (int threads : THREADCOUNTS)
+            {
+                runs.push_back(run(argv[1], modelName, inputWidth, threads));
+            }
+        }
+    }
+
+    ofstream report(reportPath);
+    report << "{\"input\":\"" << argv[1] << "\",\"replayFps\":" << REPLAYFPS << ",\"runs\":[";
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        report << (i ? ",\n" : "\n") << runs[i];
+    }
+    report << "\n]}\n";
+    cout << "Wrote " << runs.size() << " runs to " << reportPath << endl;
+    return 0;
+}
@@ -0,0 +1,104 @@
+// g++ -o benchsharpness benchsharpness.cpp `pkg-config --cflags --libs opencv4` -std=c++14 -O2 -march=native
+//
+// Compares the sharpness kernel in sharpness.hpp with the cv::Laplacian + cv::meanStdDev version herken.cpp used before,
+// both for the value (and so the BLURRYNESSTHRESHHOLD decision) and for speed.
+//
+// ./benchsharpness                    random and blurred synthetic crops
+// ./benchsharpness face_1.jpg ...     real face crops
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+
+#include "sharpness.hpp"
+
+#define BLURRYNESSTHRESHHOLD 400
+#define ITERATIONS 200
+
+using namespace cv;
+using namespace std;
+
+// The original checkBluriness from herken.cpp
+double referenceBluriness(const Mat &image)
+{
+    Mat gray;
+    cvtColor(image, gray, COLOR_BGR2GRAY);
+
+    Mat laplacian;
+    Laplacian(gray, laplacian, CV_64F);
+
+    Scalar mean, stddev;
+    meanStdDev(laplacian, mean, stddev);
+
+    return stddev.val[0] * stddev.val[0];
+}
+
+// Noise crops of typical face sizes, blurred by different amounts so they land on both sides of the threshold
+vector<Mat> syntheticFaces()
+{
+    const Size sizes[] = {Size(96, 120), Size(180, 220), Size(301, 377), Size(640, 640)};
+    const int blurs[] = {1, 3, 7, 15};
+    RNG rng(1234);
+    vector<Mat> faces;
+    for (Size size : sizes)
+    {
+        for (int blur : blurs)
+        {
+            Mat face(size, CV_8UC3);
+            rng.fill(face, RNG::UNIFORM, 0, 256);
+            GaussianBlur(face, face, Size(blur, blur), 0);
+            faces.push_back(face);
+        }
+    }
+    return faces;
+}
+
+int main(int argc, char **argv)
+{
+    vector<Mat> faces;
+    for (int i = 1; i < argc; ++i)
+    {
+        Mat face = imread(argv[i]);
+        if (face.empty())
+            cerr << "Unable to read " << argv[i] << endl;
+        else
+            faces.push_back(face);
+    }
+    if (faces.empty())
+        faces = syntheticFaces();
+
+    // Values have to match up to floating point noise and never end up on different sides of the threshold
+    Mat gray;
+    double worstDifference = 0;
+    int disagreements = 0;
+    for (const Mat &face : faces)
+    {
+        double reference = referenceBluriness(face);
+        double score = sharpnessScore(face, gray);
+        worstDifference = max(worstDifference, fabs(reference - score) / max(1.0, reference));
+        if ((reference <= BLURRYNESSTHRESHHOLD) != (score <= BLURRYNESSTHRESHHOLD))
+            disagreements++;
+    }
+
+    double checksum = 0;
+    int64 start = getTickCount();
+    for (int i = 0; i < ITERATIONS; ++i)
+        for (const Mat &face : faces)
+            checksum += referenceBluriness(face);
+    double referenceMicros = (getTickCount() - start) * 1e6 / getTickFrequency() / ITERATIONS / faces.size();
+
+    start = getTickCount();
+    for (int i = 0; i < ITERATIONS; ++i)
+        for (const Mat &face : faces)
+            checksum -= sharpnessScore(face, gray);
+    double kernelMicros = (getTickCount() - start) * 1e6 / getTickFrequency() / ITERATIONS / faces.size();
+
+    cout << faces.size() << " faces, largest relative difference " << worstDifference
+         << ", threshold decisions that differ: " << disagreements << endl;
+    cout << "cv::Laplacian + meanStdDev: " << referenceMicros << " us/face" << endl;
+    cout << "sharpness kernel:           " << kernelMicros << " us/face (" << referenceMicros / kernelMicros << "x)" << endl;
+    (void)checksum;
+    return disagreements == 0 && worstDifference < 1e-6 ? 0 : -1;
+}
@@ -0,0 +1,29 @@
+// g++ -o faceinator faceinator.cpp `pkg-config --cflags --libs opencv4` -lmosquitto -std=c++14 -pthread -lrt -O2 -march=native
+//
+// The MQTT bridge and the detector in one program. The bridge hands the game state to the detector through a GameChannel
+// and the detector posts back when it is ready and when the faces are in, no text files in between. Only the image
+// generator still goes through numPlayers.txt, scanningComplete.txt and done.txt.
+// herken + mqtt as two programs still works the same, they run the channel over the files.
+
+// The bridge goes first, so its headers are not parsed under the using namespace cv and std of herken
+#include "mqttbridge.hpp"
+
+#define HERKEN_NO_MAIN
+#include "herken.cpp"
+
+int main()
+{
+    GameChannel channel;
+
+    mosquitto_lib_init();
+    MosquittoClient *mosquittoClient = MosquittoClient::getInstance(channel, false);
+    GameLogic gameLogic(mosquittoClient);
+    std::thread bridgeThread([&gameLogic]
+                             { gameLogic.logic(); });
+    bridgeThread.detach();
+
+    int result = runDetector(channel);
+    // The bridge loop never returns, end the program without destroying the channel it still uses
+    std::cout << std::flush;
+    std::quick_exit(result);
+}
@@ -0,0 +1,266 @@
+// Cheap face tracker for the frames between two detector runs
+//
+// After every detection the faces are matched to the ones from the previous run by box overlap, so each person keeps
+// the same id, and a few corners inside every box are picked. On the following frames those corners are followed with
+// pyramidal Lucas-Kanade optical flow and the boxes are moved (and scaled) by the median of their motion. When too many
+// corners of a face get lost the tracker gives up, so the caller can run the detector again before the boxes drift off.
+// A face the detector misses (a head turn, dim light) is remembered for a few more runs, so it gets its id back when it
+// is found again instead of counting as somebody new.
+
+#ifndef FACETRACKER_HPP
+#define FACETRACKER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+constexpr int TRACKERMAXPOINTS = 24;           // corners followed per face
+constexpr int TRACKERMINPOINTS = 4;            // a face with fewer corners left is lost
+constexpr double TRACKERMINIOU = 0.3;          // overlap a detection needs with a known face to keep its id
+constexpr double TRACKERMINSURVIVING = 0.5;    // part of its corners a face may lose between two detections
+constexpr float TRACKERMAXFORWARDBACKWARD = 1; // pixels a corner may end up away from where it started when it is tracked back
+constexpr int TRACKERKEEPMISSED = 3;           // detector runs a face that was not found again keeps its id
+constexpr int TRACKERMINSIZE = 16;             // pixels a box needs in both directions, smaller means it is sliding off the frame
+
+class FaceTracker
+{
+public:
+    // Forget all faces, the next call has to be update()
+    void reset()
+    {
+        tracks.clear();
+        previousGray.release();
+    }
+
+    // Take the boxes of a detector run on frame, faces that overlap a known one keep its id and the rest get a new one
+    void update(const cv::Mat &frame, const cv::Rect *boxes, size_t count)
+    {
+        toGray(frame, previousGray);
+        const cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+
+        matched.assign(tracks.size(), false);
+        updated.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            Track track;
+            track.id = matchingId(boxes[i]);
+            track.box = boxes[i];
+            track.initialPoints = seedPoints(boxes[i] & frameRect, track.points);
+            track.missed = 0;
+            updated.push_back(std::move(track));
+        }
+
+        // Faces this run did not find stay where they were last seen for a while, without corners to follow
+        for (size_t i = 0; i < tracks.size(); ++i)
+        {
+            if (matched[i] || tracks[i].missed >= TRACKERKEEPMISSED)
+                continue;
+            Track track = std::move(tracks[i]);
+            track.missed++;
+            track.points.clear();
+            track.initialPoints = 0;
+            updated.push_back(std::move(track));
+        }
+        tracks.swap(updated);
+    }
+
+    // Move every face along to frame, returns false when the tracking is no longer reliable and the detector has to run
+    bool propagate(const cv::Mat &frame)
+    {
+        if (previousGray.empty())
+            return false;
+        if (tracks.empty())
+        {
+            // Nobody to follow, whoever walks in is picked up by the next detector run
+            toGray(frame, previousGray);
+            return true;
+        }
+
+        toGray(frame, gray);
+        points.clear();
+        size_t visible = 0;
+        for (const Track &track : tracks)
+        {
+            if (track.missed == 0)
+                visible++;
+            points.insert(points.end(), track.points.begin(), track.points.end());
+        }
+        if (visible == 0)
+        {
+            toGray(frame, previousGray);
+            return true;
+        }
+        if (points.empty())
+            return false;
+
+        // Track forwards and back again, corners that do not come back to where they started are not trusted
+        cv::calcOpticalFlowPyrLK(previousGray, gray, points, movedPoints, status, errors, cv::Size(15, 15), 2);
+        cv::calcOpticalFlowPyrLK(gray, previousGray, movedPoints, backPoints, backStatus, errors, cv::Size(15, 15), 2);
+
+        bool reliable = true;
+        size_t offset = 0;
+        for (Track &track : tracks)
+        {
+            if (track.missed > 0)
+                continue;
+            size_t pointCount = track.points.size();
+            reliable = moveTrack(track, offset, cv::Size(frame.cols, frame.rows)) && reliable;
+            offset += pointCount;
+        }
+
+        // A face that slid (almost) out of the frame is gone, nothing is left of it to crop
+        tracks.erase(std::remove_if(tracks.begin(), tracks.end(), [](const Track &track)
+                                    { return track.missed == 0 && (track.box.width < TRACKERMINSIZE || track.box.height < TRACKERMINSIZE); }),
+                     tracks.end());
+
+        cv::swap(previousGray, gray);
+        return reliable;
+    }
+
+    // Copy the boxes of the faces in view and their ids out, returns how many were written
+    size_t getFaces(cv::Rect *boxes, int *ids, size_t maxFaces) const
+    {
+        size_t count = 0;
+        for (const Track &track : tracks)
+        {
+            if (track.missed > 0)
+                continue;
+            if (count == maxFaces)
+                break;
+            boxes[count] = track.box;
+            ids[count] = track.id;
+            count++;
+        }
+        return count;
+    }
+
+private:
+    struct Track
+    {
+        int id;
+        cv::Rect box;
+        std::vector<cv::Point2f> points;
+        size_t initialPoints;
+        int missed; // detector runs in a row that did not find it, its box is where it was last seen
+    };
+
+    std::vector<Track> tracks;
+    int nextId = 0;
+
+    // Reused between frames
+    cv::Mat previousGray;
+    cv::Mat gray;
+    std::vector<Track> updated;
+    std::vector<bool> matched;
+    std::vector<cv::Point2f> points;
+    std::vector<cv::Point2f> movedPoints;
+    std::vector<cv::Point2f> backPoints;
+    std::vector<cv::Point2f> startPoints;
+    std::vector<uchar> status;
+    std::vector<uchar> backStatus;
+    std::vector<float> errors;
+    std::vector<float> shiftX;
+    std::vector<float> shiftY;
+    std::vector<float> scales;
+
+    static void toGray(const cv::Mat &frame, cv::Mat &out)
+    {
+        if (frame.channels() == 1)
+            frame.copyTo(out);
+        else
+            cv::cvtColor(frame, out, cv::COLOR_BGR2GRAY);
+    }
+
+    // Id of the known face box overlaps most with, or a new id
+    int matchingId(const cv::Rect &box)
+    {
+        int best = -1;
+        double bestOverlap = TRACKERMINIOU;
+        for (size_t i = 0; i < tracks.size(); ++i)
+        {
+            if (matched[i])
+                continue;
+            double intersection = (box & tracks[i].box).area();
+            double overlap = intersection / (box.area() + tracks[i].box.area() - intersection);
+            if (overlap >= bestOverlap)
+            {
+                best = (int)i;
+                bestOverlap = overlap;
+            }
+        }
+
+        if (best < 0)
+            return nextId++;
+        matched[best] = true;
+        return tracks[best].id;
+    }
+
+    // Pick the corners inside box that are easiest to follow
+    size_t seedPoints(const cv::Rect &box, std::vector<cv::Point2f> &out)
+    {
+        out.clear();
+        if (box.width < 8 || box.height < 8)
+            return 0;
+
+        int minDistance = std::max(2, std::min(box.width, box.height) / 10);
+        cv::goodFeaturesToTrack(previousGray(box), out, TRACKERMAXPOINTS, 0.01, minDistance);
+        for (cv::Point2f &point : out)
+        {
+            point.x += box.x;
+            point.y += box.y;
+        }
+        return out.size();
+    }
+
+    static float median(std::vector<float> &values)
+    {
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    }
+
+    // Apply the flow of the corners at points[offset...] to track, false if it lost too many of them
+    bool moveTrack(Track &track, size_t offset, cv::Size frameSize)
+    {
+        shiftX.clear();
+        shiftY.clear();
+        startPoints.clear();
+        size_t kept = 0;
+        for (size_t i = 0; i < track.points.size(); ++i)
+        {
+            size_t p = offset + i;
+            cv::Point2f back = backPoints[p] - points[p];
+            if (!status[p] || !backStatus[p] || back.dot(back) > TRACKERMAXFORWARDBACKWARD * TRACKERMAXFORWARDBACKWARD)
+                continue;
+
+            shiftX.push_back(movedPoints[p].x - points[p].x);
+            shiftY.push_back(movedPoints[p].y - points[p].y);
+            startPoints.push_back(points[p]);
+            track.points[kept++] = movedPoints[p];
+        }
+        track.points.resize(kept);
+
+        if (kept < (size_t)TRACKERMINPOINTS || kept < track.initialPoints * TRACKERMINSURVIVING)
+            return false;
+
+        // How much the face got closer or further away, from the change in distance between neighbouring corners
+        scales.clear();
+        for (size_t i = 1; i < kept; ++i)
+        {
+            float before = (float)cv::norm(startPoints[i] - startPoints[i - 1]);
+            if (before > 1)
+                scales.push_back((float)cv::norm(track.points[i] - track.points[i - 1]) / before);
+        }
+        float scale = scales.empty() ? 1.0f : median(scales);
+
+        float centerX = track.box.x + track.box.width * 0.5f + median(shiftX);
+        float centerY = track.box.y + track.box.height * 0.5f + median(shiftY);
+        float width = track.box.width * scale;
+        float height = track.box.height * scale;
+        track.box = cv::Rect(cvRound(centerX - width / 2), cvRound(centerY - height / 2), cvRound(width), cvRound(height)) &
+                    cv::Rect(0, 0, frameSize.width, frameSize.height);
+        return track.box.width >= TRACKERMINSIZE && track.box.height >= TRACKERMINSIZE;
+    }
+};
+
+#endif
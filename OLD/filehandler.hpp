@@ -0,0 +1,82 @@
+// The text files herken, the MQTT bridge and the image generator talk through, every file holds a single value
+//
+// Running the detector and the bridge as one program (faceinator.cpp) they only go through a GameChannel, the files
+// are then only written for the generator: numPlayers and scanningComplete, and done is read from it.
+
+#ifndef FILEHANDLER_HPP
+#define FILEHANDLER_HPP
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+constexpr char SCANNINGKEY[] = "scanningComplete"; // herken -> bridge and generator, the faces are written
+constexpr char STARTKEY[] = "gameStart";           // bridge -> herken
+constexpr char PLAYERSKEY[] = "numPlayers";        // bridge -> herken and generator
+constexpr char DONEKEY[] = "done";                 // generator -> bridge and herken
+constexpr char READYKEY[] = "detectorReady";       // herken -> bridge, written once the network is loaded and warmed up
+constexpr char LATENCYKEY[] = "latencyStats";      // herken -> bridge, per stage latency percentiles
+
+// Class for handling file operations
+class FileHandler
+{
+public:
+    // Write data to a file
+    static void writeToFile(const std::string &value, const std::string &name)
+    {
+        std::ofstream outFile(name + ".txt");
+        if (outFile.is_open())
+        {
+            outFile << value;
+            outFile.close();
+            std::cout << "Value has been stored in " << name << ".txt" << std::endl;
+        }
+        else
+        {
+            std::cerr << "Unable to open the file for writing." << std::endl;
+        }
+    }
+
+    // Write data next to the file and rename it over it, readers see either the old or the new value but never half of it
+    static void replaceFile(const std::string &value, const std::string &name)
+    {
+        std::string path = name + ".txt";
+        std::string temporary = path + ".tmp";
+        std::ofstream outFile(temporary);
+        if (!outFile.is_open())
+        {
+            std::cerr << "Unable to open " << temporary << " for writing." << std::endl;
+            return;
+        }
+        outFile << value;
+        outFile.close();
+        if (std::rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "Unable to replace " << path << std::endl;
+        }
+    }
+
+    // Read data from a file
+    static std::string readFromFile(const std::string &name)
+    {
+        std::ifstream inFile(name + ".txt");
+        std::string value;
+        if (inFile.is_open())
+        {
+            inFile >> value;
+            inFile.close();
+        } // if the file is empty (in some edge cases) return 0
+        else if (inFile.peek() == std::ifstream::traits_type::eof())
+        {
+            value = "0";
+        }
+        else
+        {
+            std::cerr << "Unable to open the file for reading." << std::endl;
+        }
+        return value;
+    }
+};
+
+#endif
@@ -0,0 +1,143 @@
+// inotify based watcher for the text files the programs use to talk to each other
+//
+// Instead of opening and parsing a file over and over, a handler is called only after a writer closed it
+// (or renamed a new version into place), so readers also never see the half written, empty file.
+// Either run it on its own thread with start(), or hand fd() to an existing poll/epoll loop and call dispatch().
+
+#ifndef FILEWATCHER_HPP
+#define FILEWATCHER_HPP
+
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class FileWatcher
+{
+public:
+    explicit FileWatcher(const std::string &directory = ".")
+    {
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0)
+        {
+            watchFd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        }
+        if (inotifyFd < 0 || watchFd < 0)
+        {
+            std::cerr << "Unable to watch " << directory << ", falling back to re-reading the files every second." << std::endl;
+        }
+        stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~FileWatcher()
+    {
+        stop();
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+        if (stopFd >= 0)
+            close(stopFd);
+    }
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // Call handler every time fileName (relative to the watched directory) has been written, register before start()
+    void onChange(const std::string &fileName, std::function<void()> handler)
+    {
+        handlers.emplace_back(fileName, std::move(handler));
+    }
+
+    // Descriptor that becomes readable when there are events for dispatch(), -1 when inotify is not available
+    int fd() const
+    {
+        return watchFd >= 0 ? inotifyFd : -1;
+    }
+
+    // Run the handlers of every file that changed since the last call, without blocking
+    void dispatch()
+    {
+        if (fd() < 0)
+        {
+            // Without inotify there is no way to know what changed, so everything is re-read
+            for (auto &handler : handlers)
+                handler.second();
+            return;
+        }
+
+        // A writer usually produces a burst of events, each handler runs once per batch
+        std::vector<bool> changed(handlers.size(), false);
+        alignas(struct inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *ptr = buffer; ptr < buffer + length;)
+            {
+                const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+                if (event->len > 0)
+                {
+                    for (size_t i = 0; i < handlers.size(); ++i)
+                    {
+                        if (handlers[i].first == event->name)
+                            changed[i] = true;
+                    }
+                }
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        for (size_t i = 0; i < handlers.size(); ++i)
+        {
+            if (changed[i])
+                handlers[i].second();
+        }
+    }
+
+    // Dispatch on a background thread until stop(), it sleeps in poll() while nothing changes
+    void start()
+    {
+        running = true;
+        thread = std::thread([this]
+                             {
+            struct pollfd fds[2] = {{fd(), POLLIN, 0}, {stopFd, POLLIN, 0}};
+            while (running)
+            {
+                int timeout = fd() >= 0 ? -1 : 1000;
+                if (poll(fds, 2, timeout) < 0)
+                    continue;
+                if (fds[1].revents & POLLIN)
+                    break;
+                if (fd() < 0 || (fds[0].revents & POLLIN))
+                    dispatch();
+            } });
+    }
+
+    void stop()
+    {
+        running = false;
+        if (stopFd >= 0)
+        {
+            uint64_t one = 1;
+            ssize_t ignored = write(stopFd, &one, sizeof(one));
+            (void)ignored;
+        }
+        if (thread.joinable())
+            thread.join();
+    }
+
+private:
+    int inotifyFd = -1;
+    int watchFd = -1;
+    int stopFd = -1;
+    std::vector<std::pair<std::string, std::function<void()>>> handlers;
+    std::thread thread;
+    std::atomic<bool> running{false};
+};
+
+#endif
@@ -0,0 +1,104 @@
+// Link between the MQTT bridge and the detector when they run in the same process
+//
+// The bridge sets the game state the detector reads on every frame (SharedGameState, a single atomic word). The other
+// way the detector posts events as bits in an atomic word and wakes the bridge through an eventfd it keeps in its epoll
+// set, nothing is written to or read from a file. The files are only a shim for running herken and mqtt as two programs.
+
+#ifndef GAMECHANNEL_HPP
+#define GAMECHANNEL_HPP
+
+#include "gamestate.hpp"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Events the detector posts for the bridge, several can be pending at once
+constexpr uint32_t DETECTORREADY = 1 << 0;    // the network is loaded and warmed up, or it is not anymore, see detectorReady()
+constexpr uint32_t SCANNINGCOMPLETE = 1 << 1; // the faces of the players are written
+constexpr uint32_t LATENCYREPORT = 1 << 2;    // a new report is waiting in takeLatencyReport()
+
+class GameChannel
+{
+public:
+    // Bridge -> detector
+    SharedGameState game;
+
+    GameChannel()
+    {
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~GameChannel()
+    {
+        if (eventFd >= 0)
+            close(eventFd);
+    }
+
+    GameChannel(const GameChannel &) = delete;
+    GameChannel &operator=(const GameChannel &) = delete;
+
+    // Descriptor that becomes readable when events are pending
+    int fd() const
+    {
+        return eventFd;
+    }
+
+    // Detector side
+    void post(uint32_t events)
+    {
+        pending.fetch_or(events, std::memory_order_release);
+        uint64_t one = 1;
+        ssize_t ignored = write(eventFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void setDetectorReady(bool isReady)
+    {
+        ready.store(isReady, std::memory_order_release);
+        post(DETECTORREADY);
+    }
+
+    // The report is the only thing behind a lock, one comes every so many seconds
+    void postLatencyReport(const std::string &json)
+    {
+        {
+            std::lock_guard<std::mutex> lock(latencyMutex);
+            latencyReport = json;
+        }
+        post(LATENCYREPORT);
+    }
+
+    // Bridge side, all events posted since the last call
+    uint32_t take()
+    {
+        uint64_t count;
+        ssize_t ignored = read(eventFd, &count, sizeof(count));
+        (void)ignored;
+        return pending.exchange(0, std::memory_order_acquire);
+    }
+
+    bool detectorReady() const
+    {
+        return ready.load(std::memory_order_acquire);
+    }
+
+    std::string takeLatencyReport()
+    {
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        std::string json;
+        json.swap(latencyReport);
+        return json;
+    }
+
+private:
+    int eventFd = -1;
+    std::atomic<uint32_t> pending{0};
+    std::atomic<bool> ready{false};
+    std::mutex latencyMutex;
+    std::string latencyReport;
+};
+
+#endif
@@ -0,0 +1,104 @@
+// Game state shared between whatever delivers it (file watcher, MQTT) and the detector's hot path
+
+#ifndef GAMESTATE_HPP
+#define GAMESTATE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// What the detector needs to know about the game, taken as one consistent copy
+struct GameStateSnapshot
+{
+    int numberPlayers = 0;
+    int gameStart = 0;
+    int done = 0;
+
+    bool readyToStart() const
+    {
+        return gameStart != 0 && numberPlayers != 0;
+    }
+};
+
+// All values are packed in a single atomic word, so reading them costs one load and never mixes two updates.
+// Threads that have nothing to do until the state changes can sleep in waitUntil() instead of polling.
+class SharedGameState
+{
+public:
+    GameStateSnapshot load() const
+    {
+        return unpack(state.load(std::memory_order_acquire));
+    }
+
+    void store(const GameStateSnapshot &snapshot)
+    {
+        state.store(pack(snapshot), std::memory_order_release);
+        wakeWaiters();
+    }
+
+    // Change some of the values without losing what another thread stored in the meantime, returns the new state.
+    // change gets a copy of the current state to modify and may be called more than once
+    template <typename Change>
+    GameStateSnapshot update(Change change)
+    {
+        uint64_t packed = state.load(std::memory_order_acquire);
+        GameStateSnapshot snapshot;
+        do
+        {
+            snapshot = unpack(packed);
+            change(snapshot);
+        } while (!state.compare_exchange_weak(packed, pack(snapshot), std::memory_order_acq_rel, std::memory_order_acquire));
+        wakeWaiters();
+        return snapshot;
+    }
+
+    // Sleep until condition holds for the current state or close() is called, returns the state it woke up to
+    template <typename Condition>
+    GameStateSnapshot waitUntil(Condition condition)
+    {
+        std::unique_lock<std::mutex> lock(waitMutex);
+        changed.wait(lock, [&]
+                     { return closed || condition(load()); });
+        return load();
+    }
+
+    // Release everything sleeping in waitUntil(), used when shutting down
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(waitMutex);
+        closed = true;
+        changed.notify_all();
+    }
+
+private:
+    std::atomic<uint64_t> state{0};
+    std::mutex waitMutex;
+    std::condition_variable changed;
+    bool closed = false;
+
+    static uint64_t pack(const GameStateSnapshot &snapshot)
+    {
+        return ((uint64_t)(uint16_t)snapshot.numberPlayers << 32) |
+               ((uint64_t)(uint16_t)snapshot.gameStart << 16) |
+               (uint16_t)snapshot.done;
+    }
+
+    static GameStateSnapshot unpack(uint64_t packed)
+    {
+        GameStateSnapshot snapshot;
+        snapshot.numberPlayers = (int16_t)(packed >> 32);
+        snapshot.gameStart = (int16_t)(packed >> 16);
+        snapshot.done = (int16_t)packed;
+        return snapshot;
+    }
+
+    void wakeWaiters()
+    {
+        // Updates are rare, so waking the sleepers every time costs nothing worth mentioning
+        std::lock_guard<std::mutex> lock(waitMutex);
+        changed.notify_all();
+    }
+};
+
+#endif
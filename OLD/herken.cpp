@@ -1,4 +1,4 @@
-// g++ -o herken herken.cpp `pkg-config --cflags --libs opencv4` -std=c++14
+// g++ -o herken herken.cpp `pkg-config --cflags --libs opencv4` -std=c++14 -pthread -lrt -O2 -march=native
 
 #include <opencv2/opencv.hpp>
 #include <iostream>
@@ -8,13 +8,30 @@
 #include <string>
 #include <algorithm>
 #include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <unistd.h>
+#include <sys/stat.h>
 
 // Constants
 #define FRAMEWIDTH 1280
 #define FRAMEHEIGHT 640
 #define EXPANSIONPIXELS 50
 #define BLURRYNESSTHRESHHOLD 400
+#define MAXFACES 16        // Most faces handed out per frame
+#define MINFACESIZE 16     // Crops smaller than this in either direction are not kept
+#define MAXCANDIDATES 1024 // Boxes above the confidence threshold we make room for up front
+#define CAPTUREWINDOWFRAMES 15 // Frames a face may be out of sight before its crops are forgotten
+#define CROPSPERFACE 3         // Sharpest crops kept per face
+#define ROIMARGIN 0.5          // The region around the known faces grows by this part of their size on every side
+#define REGIONINPUTSIZES {cv::Size(192, 192), cv::Size(320, 224), cv::Size(448, 192)} // A region is grown to the first of these it fits in, smallest first. Each one gets its own network
+#define FULLFRAMEINTERVAL 10   // Every this many detector runs the whole frame is looked at again, instead of only the region around the faces
+#define DETECTIONINTERVAL 5    // Run the detector on every this many frames, the tracker moves the boxes along in between. 1 turns tracking off
 
 // #define YOLO8WEIGHTS "models/yolo8_weights.caffemodel"
 #define YOLO4WEIGHTS "models/yolov4-tiny-3l_best.weights"
@@ -24,524 +41,1820 @@
 #define YOLO4CONFIG "models/yolov4-tiny-3l.cfg"
 // #define YOLO3CONFIG "models/yolov3-face.cfg"
 
-// keys for what the files are called
-#define SCANNINGKEY "scanningComplete"
-#define STARTKEY "gameStart"
-#define PLAYERSKEY "numPlayers"
-#define DONEKEY "done"
+// Images the INT8 network is calibrated with, one path per line, written by benchint8
+#define INT8CALIBRATIONLIST "models/int8calibration.txt"
+#define INT8CALIBRATIONIMAGES 12 // at most this many are used, quantizing runs them through the network as one batch and that has to fit in the memory of the Pi
+
+#include "yolodecode.hpp"
+#include "filewatcher.hpp"
+#include "filehandler.hpp"
+#include "gamechannel.hpp"
+#include "sharpness.hpp"
+#include "facetracker.hpp"
+#include "motiongate.hpp"
+#include "jpegdecodepool.hpp"
+#include "v4l2capture.hpp"
+#include "latency.hpp"
+#include "replaycapture.hpp"
+#include "sharedsegment.hpp"
+
+#define LATENCYINTERVAL 30 // seconds between two latency reports
 
 // Display the webcam output or not
 bool showFrame = false;
+// Faces are counted at the width from the cfg, this redoes the detection at FRAMEWIDTH x FRAMEHEIGHT right before a capture is saved
+bool multiScaleDetection = true;
+// Run the network quantized to INT8, calibrated with the images in INT8CALIBRATIONLIST. Falls back to FP32 if that does not work out
+bool int8Inference = false;
+// Once faces are known, run the detector at native resolution on the region around them instead of on the whole frame
+bool regionDetection = true;
+// Skip the network while nothing moves in front of the camera and nobody is in view
+bool motionGating = true;
+// Talk to a separately running mqtt through shared memory, the text files are only used when the segment can not be opened
+bool sharedMemoryIpc = true;
 
 using namespace cv;
 using namespace std;
 
-// Class for handling file operations
-class FileHandler
+// Input resolution the network runs at, a quick look to see if anyone is there or a detailed pass for the capture
+enum class DetectionScale
+{
+    Presence,
+    Capture,
+    Native // whatever frame is passed at its own resolution, for the regions around known faces
+};
+
+// Abstract YOLO Model Interface this way you can change out yolo models without losing functionality
+class IYoloModel
 {
 public:
-    // Write data to a file
-    static void writeToFile(const std::string &value, const std::string &name)
+    virtual void loadModel(const std::string &config, const std::string &weights) = 0;
+    virtual std::vector<cv::Rect> detectFaces(const cv::Mat &frame) = 0;
+    // Allocation free variant, writes at most maxFaces boxes into faces and returns how many were written
+    virtual size_t detectFaces(const cv::Mat &frame, cv::Rect *faces, size_t maxFaces)
+    {
+        std::vector<cv::Rect> found = detectFaces(frame);
+        size_t count = std::min(found.size(), maxFaces);
+        std::copy(found.begin(), found.begin() + count, faces);
+        return count;
+    }
+    // Detect the faces in several frames at once, faces[i] gets the boxes of frames[i]. Models that can run a batch
+    // through the network in one go override this, the default simply does one frame after the other
+    virtual void detectFacesBatch(const std::vector<cv::Mat> &frames, std::vector<std::vector<cv::Rect>> &faces)
     {
-        std::ofstream outFile(name + ".txt");
-        if (outFile.is_open())
+        faces.resize(frames.size());
+        for (size_t i = 0; i < frames.size(); ++i)
         {
-            outFile << value;
-            outFile.close();
-            std::cout << "Value has been stored in " << name << ".txt" << std::endl;
+            faces[i] = detectFaces(frames[i]);
         }
-        else
+    }
+    // Switch to an INT8 quantized version of the network, calibrated on images that look like what it will see.
+    // Returns false and keeps running in FP32 when the model or the OpenCV build can not do it
+    virtual bool useInt8(const std::vector<cv::Mat> & /*calibrationImages*/) { return false; }
+    // Run the network once at every input size it is going to see, so the first real frame is not the slow one
+    virtual void warmUp() {}
+    // Select the input resolution for the following detectFaces calls, models with a single input size ignore this
+    virtual void setDetectionScale(DetectionScale /*scale*/) {}
+    // Run the Presence scale at another input size than the one the network was trained for, for benchmarking
+    virtual void setInputSize(cv::Size /*size*/) {}
+    // Input size of the Presence scale, empty for models that do not say
+    virtual cv::Size getPresenceInputSize() const { return cv::Size(); }
+    virtual ~IYoloModel() {}
+};
+
+// Read the network input size from the [net] section of a Darknet cfg, returns an empty size when it is not in there
+cv::Size readDarknetInputSize(const std::string &config)
+{
+    std::ifstream cfgFile(config);
+    std::string line;
+    bool inNetSection = false;
+    int width = 0;
+    int height = 0;
+
+    while (std::getline(cfgFile, line))
+    {
+        line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+        if (line.empty() || line[0] == '#' || line[0] == ';')
+            continue;
+
+        if (line[0] == '[')
         {
-            std::cerr << "Unable to open the file for writing." << std::endl;
+            // The [net] section always comes first, so the next section header means we are done
+            if (inNetSection)
+                break;
+            inNetSection = (line == "[net]" || line == "[network]");
+            continue;
         }
+
+        size_t separator = line.find('=');
+        if (!inNetSection || separator == std::string::npos)
+            continue;
+
+        std::string key = line.substr(0, separator);
+        if (key == "width")
+            width = std::atoi(line.c_str() + separator + 1);
+        else if (key == "height")
+            height = std::atoi(line.c_str() + separator + 1);
     }
+    return cv::Size(width, height);
+}
+
+// Round a size up to the 32 pixel stride the YOLO heads need
+cv::Size alignToStride(cv::Size size)
+{
+    return cv::Size((size.width + 31) / 32 * 32, (size.height + 31) / 32 * 32);
+}
 
-    // Read data from a file
-    static std::string readFromFile(const std::string &name)
+// Scale the frame into the network input without distorting it and pad the rest with grey, like Darknet does.
+// resized is scratch space the caller can keep around between frames.
+LetterboxInfo letterboxFrame(const cv::Mat &frame, cv::Mat &letterboxed, cv::Mat &resized, cv::Size inputSize)
+{
+    LetterboxInfo info;
+    info.inputSize = inputSize;
+    info.scale = std::min((float)inputSize.width / frame.cols, (float)inputSize.height / frame.rows);
+
+    int resizedWidth = std::min(inputSize.width, (int)std::round(frame.cols * info.scale));
+    int resizedHeight = std::min(inputSize.height, (int)std::round(frame.rows * info.scale));
+    info.padX = (inputSize.width - resizedWidth) / 2;
+    info.padY = (inputSize.height - resizedHeight) / 2;
+
+    // Never point the scratch buffer at the frame itself, the next resize would write into the capture buffer
+    const cv::Mat *source = &frame;
+    if (resizedWidth != frame.cols || resizedHeight != frame.rows)
     {
-        std::ifstream inFile(name + ".txt");
-        std::string value;
-        if (inFile.is_open())
+        cv::resize(frame, resized, cv::Size(resizedWidth, resizedHeight), 0, 0, cv::INTER_LINEAR);
+        source = &resized;
+    }
+
+    cv::copyMakeBorder(*source, letterboxed, info.padY, inputSize.height - resizedHeight - info.padY,
+                       info.padX, inputSize.width - resizedWidth - info.padX, cv::BORDER_CONSTANT, cv::Scalar(127, 127, 127));
+    return info;
+}
+
+// Modification time of a file, 0 if it is not there
+time_t fileTime(const std::string &path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+}
+
+// Output layouts the YoloDarknetModel can be specialized on, each one knows how to load its network and decode its outputs
+struct DarknetRowLayout
+{
+    static dnn::Net readNet(const std::string &config, const std::string &weights)
+    {
+        return dnn::readNetFromDarknet(config, weights);
+    }
+
+    // The size the network was trained for is in the [net] section of the cfg
+    static cv::Size inputSize(const std::string &config)
+    {
+        return readDarknetInputSize(config);
+    }
+
+    // Darknet networks are fully convolutional, any input size that is a multiple of the stride works
+    static constexpr bool fixedInputSize = false;
+
+    static void decode(const cv::Mat &out, const LetterboxInfo &letterbox, cv::Size frameSize, float confidenceThreshold,
+                       std::vector<int> &survivors, std::vector<cv::Rect> &boxes, std::vector<float> &confidences)
+    {
+        decodeDarknetOutput(out, letterbox, frameSize, confidenceThreshold, survivors, boxes, confidences);
+    }
+};
+
+struct Yolov8TransposedLayout
+{
+    // YOLOv8 comes as a single ONNX file, there is no separate config
+    static dnn::Net readNet(const std::string &model, const std::string & /*weights*/)
+    {
+        return dnn::readNet(model);
+    }
+
+    // The ultralytics exports are made for a 640x640 input
+    static cv::Size inputSize(const std::string & /*model*/)
+    {
+        return cv::Size(640, 640);
+    }
+
+    // The head reshapes to the 8400 anchors of a 640x640 input, so the other detection scales can not be used
+    static constexpr bool fixedInputSize = true;
+
+    static void decode(const cv::Mat &out, const LetterboxInfo &letterbox, cv::Size frameSize, float confidenceThreshold,
+                       std::vector<int> &survivors, std::vector<cv::Rect> &boxes, std::vector<float> &confidences)
+    {
+        decodeYolov8Output(out, letterbox, frameSize, confidenceThreshold, survivors, boxes, confidences);
+    }
+};
+
+// YOLO model running on OpenCV DNN, the output layout is a template parameter so the decoding gets inlined per model
+template <typename Layout>
+class YoloDarknetModel : public IYoloModel
+{
+private:
+    // OpenCV throws away the buffers of a network whenever its input shape changes, so every input size gets a network
+    // of its own. They are all read from the same files and each holds its own copy of the weights (about 25 MB for
+    // yolov4-tiny), but once allocated they stay allocated
+    struct SizedNet
+    {
+        cv::Size inputSize;
+        dnn::Net net;
+        vector<cv::String> outputNames;
+    };
+
+    std::vector<SizedNet> nets;
+    std::string configPath;
+    std::string weightsPath;
+    cv::Mat calibrationBlob; // set while running INT8, every network read afterwards is quantized with it too
+    float confidenceThreshold;
+    float nmsThreshold;
+    cv::Size presenceInputSize = cv::Size(FRAMEWIDTH, FRAMEHEIGHT);
+    cv::Size captureInputSize = alignToStride(cv::Size(FRAMEWIDTH, FRAMEHEIGHT));
+    DetectionScale detectionScale = DetectionScale::Presence;
+
+    // Buffers reused for every frame, once they have grown to size the detection does not allocate anymore
+    cv::Mat resized;
+    cv::Mat letterboxed;
+    std::vector<cv::Mat> letterboxedBatch;
+    std::vector<LetterboxInfo> letterboxes;
+    cv::Mat blob;
+    std::vector<cv::Mat> outs;
+    std::vector<int> survivors;
+    std::vector<float> confidences;
+    std::vector<cv::Rect> boxes;
+    std::vector<int> indices;
+
+public:
+    explicit YoloDarknetModel(float confidenceThreshold, float nmsThreshold = 0.4f)
+        : confidenceThreshold(confidenceThreshold), nmsThreshold(nmsThreshold)
+    {
+        confidences.reserve(MAXCANDIDATES);
+        boxes.reserve(MAXCANDIDATES);
+        indices.reserve(MAXCANDIDATES);
+    }
+
+    // load the YOLO model
+    void loadModel(const std::string &config, const std::string &weights) override
+    {
+        configPath = config;
+        weightsPath = weights;
+        calibrationBlob.release();
+        nets.clear();
+
+        // Run at the width the network was trained for, the capture pass uses the full frame size
+        presenceInputSize = Layout::inputSize(config);
+        if (presenceInputSize.empty())
         {
-            inFile >> value;
-            inFile.close();
-        } // if the file is empty (in some edge cases) return 0
-        else if (inFile.peek() == std::ifstream::traits_type::eof())
+            std::cerr << "No input size found in " << config << ", using the full frame size." << std::endl;
+            presenceInputSize = captureInputSize;
+        }
+        presenceInputSize = presenceSizeFor(presenceInputSize.width);
+        readNet(presenceInputSize);
+    }
+
+    void setDetectionScale(DetectionScale scale) override
+    {
+        detectionScale = scale;
+    }
+
+    void setInputSize(cv::Size size) override
+    {
+        if (Layout::fixedInputSize)
         {
-            value = "0";
+            std::cerr << "This network only runs at " << presenceInputSize << ", keeping that." << std::endl;
+            return;
         }
-        else
+        presenceInputSize = alignToStride(size);
+    }
+
+    cv::Size getPresenceInputSize() const override
+    {
+        return presenceInputSize;
+    }
+
+    // The first forward call at an input size allocates the buffers and fuses the layers, on the Pi that takes seconds
+    void warmUp() override
+    {
+        cv::Mat dummy(FRAMEHEIGHT, FRAMEWIDTH, CV_8UC3, cv::Scalar(127, 127, 127));
+        DetectionScale previous = detectionScale;
+        const DetectionScale scales[] = {DetectionScale::Capture, DetectionScale::Presence};
+        for (DetectionScale scale : scales)
+        {
+            detectionScale = scale;
+            int64 start = cv::getTickCount();
+            runDetection(dummy);
+            std::cout << "Warm-up at " << inputSizeFor(dummy.size()) << " took "
+                      << (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency() << " ms" << std::endl;
+        }
+        // The sizes the region detection can use, the same ones detectInRegion() picks from
+        if (regionDetection && !Layout::fixedInputSize)
+        {
+            detectionScale = DetectionScale::Native;
+            for (cv::Size size : REGIONINPUTSIZES)
+            {
+                if (size.area() <= presenceInputSize.area())
+                    runDetection(dummy(cv::Rect(cv::Point(0, 0), size)));
+            }
+        }
+        detectionScale = previous;
+    }
+
+    // OpenCV DNN quantizes the loaded network itself, the scale of every layer comes from running the calibration images through it
+    bool useInt8(const std::vector<cv::Mat> &calibrationImages) override
+    {
+        if (calibrationImages.empty())
+        {
+            std::cerr << "No calibration images, staying at FP32." << std::endl;
+            return false;
+        }
+
+        // Prepared exactly like the frames during presence detection
+        letterboxedBatch.resize(calibrationImages.size());
+        for (size_t i = 0; i < calibrationImages.size(); ++i)
+        {
+            letterboxFrame(calibrationImages[i], letterboxedBatch[i], resized, presenceInputSize);
+        }
+        cv::Mat calibration;
+        cv::dnn::blobFromImages(letterboxedBatch, calibration, 1 / 255.0, cv::Size(), cv::Scalar(0, 0, 0), true, false);
+
+        try
+        {
+            for (SizedNet &sized : nets)
+            {
+                quantize(sized, calibration);
+            }
+        }
+        catch (const cv::Exception &e)
+        {
+            std::cerr << "Unable to quantize the network, staying at FP32: " << e.what() << std::endl;
+            // Some may have been quantized already, start over from the files
+            std::vector<cv::Size> sizes;
+            for (const SizedNet &sized : nets)
+                sizes.push_back(sized.inputSize);
+            nets.clear();
+            for (cv::Size size : sizes)
+                readNet(size);
+            return false;
+        }
+        calibrationBlob = calibration;
+        std::cout << "Running INT8, calibrated on " << calibrationImages.size() << " images" << std::endl;
+        return true;
+    }
+
+    std::vector<cv::Rect> detectFaces(const cv::Mat &frame) override
+    {
+        runDetection(frame);
+
+        // Filter boxes based on NMS indices
+        std::vector<cv::Rect> faces;
+        faces.reserve(indices.size());
+        for (int idx : indices)
+        {
+            faces.push_back(boxes[idx]);
+        }
+
+        return faces; // Return the list of faces after NMS
+    }
+
+    size_t detectFaces(const cv::Mat &frame, cv::Rect *faces, size_t maxFaces) override
+    {
+        runDetection(frame);
+
+        // NMS hands the indices back sorted by confidence, so when there is no room for all of them the best ones are kept
+        size_t count = std::min(indices.size(), maxFaces);
+        for (size_t i = 0; i < count; ++i)
+        {
+            faces[i] = boxes[indices[i]];
+        }
+
+        return count;
+    }
+
+    // All frames go through the network as a single NCHW blob, one forward call for the whole batch
+    void detectFacesBatch(const std::vector<cv::Mat> &frames, std::vector<std::vector<cv::Rect>> &faces) override
+    {
+        faces.resize(frames.size());
+        if (frames.empty())
+            return;
+
+        // Every frame is letterboxed into the same input size, so frames of different cameras can share the batch
+        cv::Size inputSize = inputSizeFor(frames[0].size());
+        letterboxedBatch.resize(frames.size());
+        letterboxes.resize(frames.size());
+        {
+            ScopedTimer timer(Stage::Preprocess);
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                letterboxes[i] = letterboxFrame(frames[i], letterboxedBatch[i], resized, inputSize);
+            }
+            cv::dnn::blobFromImages(letterboxedBatch, blob, 1 / 255.0, cv::Size(), cv::Scalar(0, 0, 0), true, false);
+        }
+        SizedNet &sized = netFor(inputSize);
+        sized.net.setInput(blob);
+        {
+            ScopedTimer timer(Stage::Forward);
+            sized.net.forward(outs, sized.outputNames);
+        }
+
+        // Hand every frame its own part of the outputs
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            decodeOutputs((int)i, letterboxes[i], frames[i].size());
+            faces[i].clear();
+            for (int idx : indices)
+            {
+                faces[i].push_back(boxes[idx]);
+            }
+        }
+    }
+
+    // Get names of YOLO output layers, looked up once per model when it is loaded
+    vector<cv::String> getOutputNames(const cv::dnn::Net &net) const
+    {
+        // retrieve all layer names from the yolo network and resize the name vector accordingly
+        vector<int> outLayers = net.getUnconnectedOutLayers();
+        vector<cv::String> layersNames = net.getLayerNames();
+        vector<cv::String> names(outLayers.size());
+        // put all the names in the names vector
+        for (size_t i = 0; i < outLayers.size(); ++i)
+        {
+            names[i] = layersNames[outLayers[i] - 1];
+        }
+        return names;
+    }
+
+private:
+    // The cfg width at the aspect of the frame, a square input would spend half of it on the grey bars around a 2:1 frame
+    cv::Size presenceSizeFor(int width) const
+    {
+        if (Layout::fixedInputSize)
+            return presenceInputSize;
+        return alignToStride(cv::Size(width, width * FRAMEHEIGHT / FRAMEWIDTH));
+    }
+
+    // Read another copy of the network for inputSize, quantized like the others when running INT8
+    SizedNet &readNet(cv::Size inputSize)
+    {
+        SizedNet sized;
+        sized.inputSize = inputSize;
+        sized.net = Layout::readNet(configPath, weightsPath);
+        sized.net.setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
+        sized.net.setPreferableTarget(dnn::DNN_TARGET_CPU);
+        sized.outputNames = getOutputNames(sized.net);
+        if (!calibrationBlob.empty())
+            quantize(sized, calibrationBlob);
+        nets.push_back(std::move(sized));
+        return nets.back();
+    }
+
+    void quantize(SizedNet &sized, const cv::Mat &calibration)
+    {
+        dnn::Net quantized = sized.net.quantize(calibration, CV_32F, CV_32F);
+        quantized.setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
+        quantized.setPreferableTarget(dnn::DNN_TARGET_CPU);
+        sized.net = quantized;
+        sized.outputNames = getOutputNames(sized.net);
+    }
+
+    // The network that runs at inputSize, the first call for a size reads it (warmUp() does that for the fixed scales)
+    SizedNet &netFor(cv::Size inputSize)
+    {
+        for (SizedNet &sized : nets)
+        {
+            if (sized.inputSize == inputSize)
+                return sized;
+        }
+        std::cout << "Reading the network for a " << inputSize << " input" << std::endl;
+        return readNet(inputSize);
+    }
+
+    cv::Size inputSizeFor(cv::Size frameSize) const
+    {
+        if (Layout::fixedInputSize)
+            return presenceInputSize;
+        switch (detectionScale)
+        {
+        case DetectionScale::Capture:
+            return captureInputSize;
+        case DetectionScale::Native:
+            return alignToStride(frameSize);
+        default:
+            return presenceInputSize;
+        }
+    }
+
+    // Run the network on the frame, afterwards boxes holds all candidates and indices the ones that survived NMS
+    void runDetection(const cv::Mat &frame)
+    {
+        // Prepare the frame for YOLO model, letterboxed into the input size of the current scale
+        cv::Size inputSize = inputSizeFor(frame.size());
+        LetterboxInfo letterbox;
+        {
+            ScopedTimer timer(Stage::Preprocess);
+            letterbox = letterboxFrame(frame, letterboxed, resized, inputSize);
+            cv::dnn::blobFromImage(letterboxed, blob, 1 / 255.0, cv::Size(), cv::Scalar(0, 0, 0), true, false);
+        }
+
+        // Set the blob as input to the network of this input size
+        SizedNet &sized = netFor(inputSize);
+        sized.net.setInput(blob);
+
+        // Forward pass to get the outputs
+        {
+            ScopedTimer timer(Stage::Forward);
+            sized.net.forward(outs, sized.outputNames);
+        }
+        decodeOutputs(0, letterbox, frame.size());
+    }
+
+    // Decode the part of the outputs that belongs to image item of the batch, afterwards boxes holds all candidates and indices the ones that survived NMS
+    void decodeOutputs(int item, const LetterboxInfo &letterbox, cv::Size frameSize)
+    {
+        // Start from empty candidate lists, clear() keeps the memory from the previous frames
+        confidences.clear();
+        boxes.clear();
+        indices.clear();
+
+        // Process the output, the decoder scans the confidence scores in bulk and only decodes the boxes above the threshold
+        {
+            ScopedTimer timer(Stage::Decode);
+            for (size_t i = 0; i < outs.size(); ++i)
+            {
+                Layout::decode(batchItem(outs[i], item), letterbox, frameSize, confidenceThreshold, survivors, boxes, confidences);
+            }
+        }
+
+        // Apply Non-Maximum Suppression to eliminate redundant overlapping boxes
+        ScopedTimer timer(Stage::Nms);
+        cv::dnn::NMSBoxes(boxes, confidences, confidenceThreshold, nmsThreshold, indices);
+    }
+};
+
+// YOLO3 Model
+class YoloModelV3 : public YoloDarknetModel<DarknetRowLayout>
+{
+public:
+    YoloModelV3() : YoloDarknetModel(0.9f) {}
+};
+
+// YOLO4 Model
+class YoloModelV4 : public YoloDarknetModel<DarknetRowLayout>
+{
+public:
+    YoloModelV4() : YoloDarknetModel(0.5f) {}
+};
+
+// YOLOv8 Model, the face exports come with a fixed 640x640 input and may have landmarks after the face score
+class YoloModelV8 : public YoloDarknetModel<Yolov8TransposedLayout>
+{
+public:
+    YoloModelV8(float confThreshold = 0.45f, float nmsThreshold = 0.5f) : YoloDarknetModel(confThreshold, nmsThreshold) {}
+};
+
+// Single-producer/single-consumer "latest frame wins" slot between the capture and the inference thread.
+// It is triple buffered: the producer fills its back buffer and swaps it with the shared middle buffer,
+// the consumer swaps its front buffer with the middle one only when a newer frame is waiting there.
+// Neither side ever waits for the other, a frame that gets replaced before the consumer picked it up is simply dropped.
+template <typename T>
+class LatestFrameSlot
+{
+private:
+    static constexpr uint8_t INDEXMASK = 0x3;
+    static constexpr uint8_t FRESHBIT = 0x4; // set while the middle buffer holds a frame nobody consumed yet
+
+    T buffers[3];
+    std::atomic<uint8_t> middle{1};
+    uint8_t back = 0;  // only touched by the producer
+    uint8_t front = 2; // only touched by the consumer
+
+    // Only used to put the consumer to sleep when there is nothing new, the frames never go through this lock
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+    std::atomic<bool> consumerWaiting{false};
+    std::atomic<bool> closed{false};
+
+    void wakeConsumer()
+    {
+        if (consumerWaiting.load())
+        {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            waitCondition.notify_one();
+        }
+    }
+
+public:
+    // Buffer the producer may write the next frame into
+    T &backBuffer() { return buffers[back]; }
+
+    // Hand the back buffer to the consumer, returns true when an unconsumed frame got overwritten
+    bool publish()
+    {
+        uint8_t previous = middle.exchange(back | FRESHBIT);
+        back = previous & INDEXMASK;
+        wakeConsumer();
+        return (previous & FRESHBIT) != 0;
+    }
+
+    // Swap the newest frame into the front buffer, returns false if nothing new was published since the last call
+    bool tryConsume()
+    {
+        if (!(middle.load() & FRESHBIT))
+        {
+            return false;
+        }
+        front = middle.exchange(front) & INDEXMASK;
+        return true;
+    }
+
+    // Block until a new frame is published, returns false once the slot is closed and drained
+    bool waitAndConsume()
+    {
+        if (tryConsume())
+        {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(waitMutex);
+        consumerWaiting.store(true);
+        waitCondition.wait(lock, [this]
+                           { return (middle.load() & FRESHBIT) || closed.load(); });
+        consumerWaiting.store(false);
+        lock.unlock();
+        return tryConsume();
+    }
+
+    // Buffer holding the frame the consumer picked up last
+    T &frontBuffer() { return buffers[front]; }
+
+    // Tell the consumer no more frames will follow
+    void close()
+    {
+        closed.store(true);
+        std::lock_guard<std::mutex> lock(waitMutex);
+        waitCondition.notify_all();
+    }
+};
+
+// Frame counters of the capture/inference pipeline
+struct PipelineStats
+{
+    uint64_t framesCaptured;
+    uint64_t framesDropped; // captured but replaced by a newer frame before inference picked it up
+    uint64_t framesProcessed;
+    uint64_t inferencesSkipped; // processed, but the motion gate said there was no need to run the network
+};
+
+// What reads the frames from the webcam
+enum class CaptureBackend
+{
+    OpenCV,  // cv::VideoCapture, converts every frame on the capture thread
+    V4l2Mmap, // V4L2 mmap buffers handed out without a copy, converted only when inference looks at them (v4l2capture.hpp)
+    Replay    // a recording played back at fps instead of a webcam, for benchmarks (replaycapture.hpp)
+};
+
+// How the webcam is asked to deliver its frames
+struct CaptureConfig
+{
+    CaptureBackend backend = CaptureBackend::OpenCV;
+    std::string device; // V4l2Mmap: empty means /dev/video<camIndex>. Replay: the video file or directory of frames
+    std::string fourcc = "MJPG"; // pixel format, empty keeps whatever the camera defaults to (usually YUYV, slow at 1280 wide)
+    int width = FRAMEWIDTH;      // the camera picks its closest mode
+    int height = FRAMEHEIGHT;
+    int fps = 30; // Replay: 0 plays the frames back as fast as they can be copied
+    int buffers = 2;       // driver buffers, fewer means less latency, 0 keeps the default. V4l2Mmap uses at least 4, the frame slot holds up to 3
+    int decodeThreads = 2; // MJPEG only, decode on this many worker threads instead of on the capture thread, 0 turns it off
+};
+
+// Apply config to an opened camera, returns true when the camera hands out raw MJPEG buffers that still need decoding
+bool configureCapture(VideoCapture &cap, const CaptureConfig &config)
+{
+    // The format has to be set before the size, V4L2 only offers the larger sizes for some formats
+    if (config.fourcc.size() == 4)
+    {
+        cap.set(cv::CAP_PROP_FOURCC, cv::VideoWriter::fourcc(config.fourcc[0], config.fourcc[1], config.fourcc[2], config.fourcc[3]));
+    }
+    if (config.width > 0 && config.height > 0)
+    {
+        cap.set(cv::CAP_PROP_FRAME_WIDTH, config.width);
+        cap.set(cv::CAP_PROP_FRAME_HEIGHT, config.height);
+    }
+    if (config.fps > 0)
+        cap.set(cv::CAP_PROP_FPS, config.fps);
+    if (config.buffers > 0)
+        cap.set(cv::CAP_PROP_BUFFERSIZE, config.buffers);
+
+    // Check what the camera actually agreed to
+    int fourcc = (int)cap.get(cv::CAP_PROP_FOURCC);
+    bool mjpeg = fourcc == cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+    std::cout << "Webcam delivers " << std::string{(char)(fourcc & 0xFF), (char)((fourcc >> 8) & 0xFF), (char)((fourcc >> 16) & 0xFF), (char)((fourcc >> 24) & 0xFF)}
+              << " " << cap.get(cv::CAP_PROP_FRAME_WIDTH) << "x" << cap.get(cv::CAP_PROP_FRAME_HEIGHT) << " at " << cap.get(cv::CAP_PROP_FPS) << " fps" << std::endl;
+    if (config.fourcc == "MJPG" && !mjpeg)
+    {
+        std::cerr << "The webcam does not do MJPEG, using its default format." << std::endl;
+    }
+
+    // Without RGB conversion OpenCV hands back the JPEG as it came from the camera, a single row of bytes
+    if (mjpeg && config.decodeThreads > 0 && cap.set(cv::CAP_PROP_CONVERT_RGB, 0))
+    {
+        return true;
+    }
+    return false;
+}
+
+// WebcamHandler to manage webcam capture
+class WebcamHandler
+{
+protected:
+    VideoCapture cap;
+    std::unique_ptr<IYoloModel> model;
+    std::thread captureThread;    // Thread that keeps the webcam drained
+    std::thread processingThread; // Thread for asynchronous processing
+    LatestFrameSlot<CapturedFrame> latestFrame;
+    std::atomic<bool> running{false};
+
+    // Lets the capture thread sleep while nobody needs frames
+    std::mutex pauseMutex;
+    std::condition_variable pauseCondition;
+    bool capturePaused = false;
+
+    std::atomic<uint64_t> framesCaptured{0};
+    std::atomic<uint64_t> framesDropped{0};
+    std::atomic<uint64_t> framesProcessed{0};
+    std::atomic<uint64_t> inferencesSkipped{0};
+
+    // Only touched by the processing thread
+    MotionGate motionGate;
+
+    // Set when the webcam delivers raw MJPEG, the capture thread then only grabs and the pool decodes
+    std::unique_ptr<JpegDecodePool> decodePool;
+    cv::Mat rawFrame;
+
+    // Set instead of cap when the V4l2Mmap backend is used
+    std::unique_ptr<V4l2MmapCapture> mmapCapture;
+    cv::Mat convertedFrame; // BGR version of a raw frame, only touched by the processing thread
+
+    // Set instead of cap when the Replay backend is used
+    std::unique_ptr<ReplayCapture> replayCapture;
+
+public:
+    explicit WebcamHandler(int camIndex, std::unique_ptr<IYoloModel> model, const CaptureConfig &config = CaptureConfig())
+        : model(std::move(model))
+    {
+        if (config.backend == CaptureBackend::V4l2Mmap)
+        {
+            openMmapCapture(camIndex, config);
+            return;
+        }
+        if (config.backend == CaptureBackend::Replay)
+        {
+            replayCapture.reset(new ReplayCapture(config.device, config.fps));
+            if (!replayCapture->isOpened())
+                exit(-1);
+            return;
+        }
+
+        cap.open(camIndex, CAP_V4L);
+        // cap.set(cv::CAP_PROP_EXPOSURE, -1);    // Auto exposure
+        cap.set(cv::CAP_PROP_BRIGHTNESS, 208); // Adjust as necessary
+        // cap.set(cv::CAP_PROP_CONTRAST, 128);   // Adjust as necessary
+
+        if (!cap.isOpened())
+        {
+            cerr << "Error: Unable to open the webcam." << endl;
+            exit(-1);
+        }
+
+        if (configureCapture(cap, config))
+        {
+            decodePool.reset(new JpegDecodePool(config.decodeThreads, [this](cv::Mat &decoded)
+                                                { publishDecoded(decoded); }));
+        }
+    }
+
+    virtual ~WebcamHandler()
+    {
+        stop();
+        if (captureThread.joinable())
+            captureThread.join();
+        if (processingThread.joinable())
+            processingThread.join();
+        // Finish the workers while the slot they publish into is still there
+        decodePool.reset();
+    }
+
+    // Run the capture and the inference thread until the webcam stops delivering frames
+    void captureAndProcess()
+    {
+        running = true;
+        captureThread = std::thread(&WebcamHandler::captureLoop, this);
+        processingThread = std::thread(&WebcamHandler::processingLoop, this);
+        captureThread.join();
+        processingThread.join();
+
+        PipelineStats stats = getStats();
+        std::cout << "Frames captured: " << stats.framesCaptured << " dropped: " << stats.framesDropped
+                  << " processed: " << stats.framesProcessed << " inferences skipped: " << stats.inferencesSkipped << std::endl;
+    }
+
+    virtual void stop()
+    {
+        running = false;
+        resumeCapture();
+        latestFrame.close();
+    }
+
+    // Stop grabbing frames until resumeCapture(), the capture thread sleeps in the meantime
+    void pauseCapture()
+    {
+        std::lock_guard<std::mutex> lock(pauseMutex);
+        capturePaused = true;
+    }
+
+    void resumeCapture()
+    {
+        std::lock_guard<std::mutex> lock(pauseMutex);
+        capturePaused = false;
+        pauseCondition.notify_all();
+    }
+
+    PipelineStats getStats() const
+    {
+        // Frames a decode worker finished after a newer one was already handed out never reached the slot either
+        uint64_t overtaken = decodePool ? decodePool->overtaken() : 0;
+        return {framesCaptured.load(), framesDropped.load() + overtaken, framesProcessed.load(), inferencesSkipped.load()};
+    }
+
+    // Call on every frame that would go through the network, false when it can be skipped because nothing is moving.
+    // Pass facesInView when the last inference still saw someone, people standing still should not be lost.
+    bool shouldRunInference(const Mat &frame, bool facesInView)
+    {
+        if (!motionGating)
+            return true;
+
+        // The gate has to see every frame to keep its background up to date, also the ones that run anyway
+        bool moving = motionGate.update(frame);
+        if (moving || facesInView)
+            return true;
+
+        inferencesSkipped++;
+        return false;
+    }
+
+    virtual void processFrame(Mat & /*frame*/)
+    {
+        // Default implementation does nothing
+        // Override in derived classes
+    }
+
+private:
+    void openMmapCapture(int camIndex, const CaptureConfig &config)
+    {
+        std::string device = config.device.empty() ? "/dev/video" + std::to_string(std::max(0, camIndex)) : config.device;
+        uint32_t pixelFormat = V4L2_PIX_FMT_YUYV;
+        if (config.fourcc.size() == 4)
+        {
+            pixelFormat = v4l2_fourcc(config.fourcc[0], config.fourcc[1], config.fourcc[2], config.fourcc[3]);
+        }
+
+        mmapCapture.reset(new V4l2MmapCapture(device, pixelFormat, config.width, config.height, config.fps, std::max(4, config.buffers)));
+        if (!mmapCapture->isOpened())
+        {
+            cerr << "Error: Unable to open the webcam." << endl;
+            exit(-1);
+        }
+        mmapCapture->setControl(V4L2_CID_BRIGHTNESS, 208); // Adjust as necessary
+    }
+
+    // Grab frames as fast as the webcam delivers them so the driver never queues up old ones
+    void captureLoop()
+    {
+        while (running)
+        {
+            {
+                std::unique_lock<std::mutex> lock(pauseMutex);
+                pauseCondition.wait(lock, [this]
+                                    { return !capturePaused || !running; });
+            }
+            // Includes waiting for the webcam, at a steady p50 of the frame interval the camera is the bottleneck
+            ScopedTimer timer(Stage::Capture);
+
+            if (mmapCapture)
+            {
+                // The back buffer ends up pointing into the driver buffer, nothing is copied
+                if (!mmapCapture->read(latestFrame.backBuffer()))
+                    break;
+                framesCaptured++;
+                if (latestFrame.publish())
+                {
+                    framesDropped++;
+                }
+                // What came back is either consumed or dropped, give its driver buffer back right away
+                latestFrame.backBuffer().release();
+                continue;
+            }
+
+            if (decodePool)
+            {
+                // Only grab the compressed buffer here, decoding it is what used to hold the capture thread back
+                if (!cap.grab() || !cap.retrieve(rawFrame) || rawFrame.empty())
+                    break;
+                framesCaptured++;
+                if (decodePool->submit(rawFrame))
+                {
+                    framesDropped++;
+                }
+                continue;
+            }
+
+            // Read straight into the back buffer, after the first frame this reuses its memory
+            Mat &frame = latestFrame.backBuffer().image;
+            if (replayCapture)
+            {
+                if (!replayCapture->read(frame))
+                    break;
+            }
+            else
+            {
+                cap >> frame;
+                if (frame.empty())
+                    break;
+            }
+
+            framesCaptured++;
+            if (latestFrame.publish())
+            {
+                framesDropped++;
+            }
+        }
+        // The webcam is gone, also wake the inference thread wherever it waits (for a game start, for done) so the program ends
+        stop();
+    }
+
+    // Called by the decode pool workers, newest frame first and never two at the same time, so they can share the producer side of the slot
+    void publishDecoded(cv::Mat &decoded)
+    {
+        cv::swap(latestFrame.backBuffer().image, decoded);
+        if (latestFrame.publish())
+        {
+            framesDropped++;
+        }
+    }
+
+    // Always run inference on the newest frame, whatever arrived in the meantime is skipped
+    void processingLoop()
+    {
+        while (latestFrame.waitAndConsume())
+        {
+            CapturedFrame &captured = latestFrame.frontBuffer();
+            if (captured.pixelFormat == 0)
+            {
+                processFrame(captured.image);
+            }
+            else if (convertToBgr(captured, convertedFrame))
+            {
+                processFrame(convertedFrame);
+            }
+            framesProcessed++;
+        }
+    }
+};
+
+// Several cameras sharing one network. Every camera gets its own capture thread and latest frame slot, a single
+// inference thread stacks the newest frame of each camera into one batch so the network runs once for all of them
+// and the detections are handed back per camera. The game still runs on a single camera, benchcameras measures this one.
+class MultiCameraHandler
+{
+protected:
+    struct Camera
+    {
+        explicit Camera(int camIndex) : cap(camIndex, CAP_V4L) {}
+
+        VideoCapture cap;
+        std::thread captureThread;
+        LatestFrameSlot<Mat> latestFrame;
+        std::atomic<bool> ended{false}; // the camera stopped delivering frames
+        bool hasFrame = false;          // only touched by the inference thread, the front buffer holds a frame
+    };
+
+    std::vector<std::unique_ptr<Camera>> cameras;
+    std::unique_ptr<IYoloModel> model;
+    std::thread processingThread;
+    std::atomic<bool> running{false};
+
+    // Any camera publishing a frame wakes the inference thread, the frames themselves never go through this lock
+    std::mutex newFrameMutex;
+    std::condition_variable newFrameCondition;
+    std::atomic<bool> processingWaiting{false};
+    std::atomic<uint64_t> framesPublished{0};
+
+    std::atomic<uint64_t> framesCaptured{0};
+    std::atomic<uint64_t> framesDropped{0};
+    std::atomic<uint64_t> framesProcessed{0};
+
+    // Reused for every batch, only touched by the inference thread
+    std::vector<Mat> batch;
+    std::vector<size_t> batchCameras;
+    std::vector<bool> batchFresh;
+    std::vector<std::vector<cv::Rect>> batchFaces;
+
+public:
+    MultiCameraHandler(const std::vector<int> &camIndices, std::unique_ptr<IYoloModel> model, CaptureConfig config = CaptureConfig())
+        : model(std::move(model))
+    {
+        // Every camera already has a thread of its own, so each one decodes its frames there
+        config.decodeThreads = 0;
+        for (int camIndex : camIndices)
+        {
+            cameras.emplace_back(new Camera(camIndex));
+            cameras.back()->cap.set(cv::CAP_PROP_BRIGHTNESS, 208); // Adjust as necessary
+            if (!cameras.back()->cap.isOpened())
+            {
+                cerr << "Error: Unable to open webcam " << camIndex << "." << endl;
+                exit(-1);
+            }
+            configureCapture(cameras.back()->cap, config);
+        }
+    }
+
+    virtual ~MultiCameraHandler()
+    {
+        stop();
+        for (auto &camera : cameras)
+        {
+            if (camera->captureThread.joinable())
+                camera->captureThread.join();
+        }
+        if (processingThread.joinable())
+            processingThread.join();
+    }
+
+    // Run all capture threads and the inference thread until every camera stopped delivering frames
+    void captureAndProcess()
+    {
+        running = true;
+        for (auto &camera : cameras)
+        {
+            camera->captureThread = std::thread(&MultiCameraHandler::captureLoop, this, std::ref(*camera));
+        }
+        processingThread = std::thread(&MultiCameraHandler::processingLoop, this);
+        for (auto &camera : cameras)
+        {
+            camera->captureThread.join();
+        }
+        processingThread.join();
+
+        PipelineStats stats = getStats();
+        std::cout << cameras.size() << " cameras, frames captured: " << stats.framesCaptured << " dropped: " << stats.framesDropped
+                  << " processed: " << stats.framesProcessed << std::endl;
+    }
+
+    virtual void stop()
+    {
+        running = false;
+        wakeProcessing();
+    }
+
+    PipelineStats getStats() const
+    {
+        return {framesCaptured.load(), framesDropped.load(), framesProcessed.load(), 0};
+    }
+
+    // Called on the inference thread for every camera that had a new frame in the batch
+    virtual void processDetections(size_t camera, Mat &frame, const std::vector<cv::Rect> &faces)
+    {
+        std::cout << "Camera " << camera << ", number of faces found: " << faces.size() << std::endl;
+        if (showFrame)
+        {
+            for (const auto &face : faces)
+            {
+                rectangle(frame, face, Scalar(0, 0, 255), 2); // Red rectangle with thickness of 2
+            }
+            imshow("Camera " + std::to_string(camera), frame);
+            waitKey(1);
+        }
+    }
+
+private:
+    void wakeProcessing()
+    {
+        framesPublished++;
+        if (processingWaiting.load())
+        {
+            std::lock_guard<std::mutex> lock(newFrameMutex);
+            newFrameCondition.notify_one();
+        }
+    }
+
+    void captureLoop(Camera &camera)
+    {
+        while (running)
+        {
+            Mat &frame = camera.latestFrame.backBuffer();
+            {
+                ScopedTimer timer(Stage::Capture);
+                camera.cap >> frame;
+            }
+            if (frame.empty())
+                break;
+
+            framesCaptured++;
+            if (camera.latestFrame.publish())
+            {
+                framesDropped++;
+            }
+            wakeProcessing();
+        }
+        camera.ended = true;
+        wakeProcessing();
+    }
+
+    bool allCamerasEnded() const
+    {
+        for (const auto &camera : cameras)
+        {
+            if (!camera->ended)
+                return false;
+        }
+        return true;
+    }
+
+    void processingLoop()
+    {
+        while (running)
+        {
+            uint64_t published = framesPublished.load();
+
+            // Pick up whatever is new, every camera keeps its last frame in the front buffer
+            batch.clear();
+            batchCameras.clear();
+            batchFresh.clear();
+            size_t fresh = 0;
+            for (size_t i = 0; i < cameras.size(); ++i)
+            {
+                Camera &camera = *cameras[i];
+                bool isNew = camera.latestFrame.tryConsume();
+                if (isNew)
+                {
+                    camera.hasFrame = true;
+                    fresh++;
+                }
+                // Cameras without a new frame still go in with their last one, a batch that keeps the same size
+                // does not make the network reallocate its buffers
+                if (camera.hasFrame && !camera.ended)
+                {
+                    batch.push_back(camera.latestFrame.frontBuffer());
+                    batchCameras.push_back(i);
+                    batchFresh.push_back(isNew);
+                }
+            }
+
+            if (fresh == 0)
+            {
+                if (allCamerasEnded())
+                    break;
+
+                // Sleep until any camera publishes a frame
+                std::unique_lock<std::mutex> lock(newFrameMutex);
+                processingWaiting = true;
+                newFrameCondition.wait(lock, [this, published]
+                                       { return framesPublished.load() != published || !running; });
+                processingWaiting = false;
+                continue;
+            }
+
+            model->detectFacesBatch(batch, batchFaces);
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                if (batchFresh[i])
+                    processDetections(batchCameras[i], batch[i], batchFaces[i]);
+            }
+            framesProcessed += fresh;
+        }
+        running = false;
+    }
+};
+
+// Encodes and writes images on its own thread, so JPEG encoding never holds up capture or inference
+class AsyncImageWriter
+{
+private:
+    struct Job
+    {
+        std::string filename;
+        cv::Mat image;
+        std::function<void()> callback; // set for the markers queued by whenDone()
+    };
+
+    std::deque<Job> jobs;
+    std::mutex jobsMutex;
+    std::condition_variable jobsCondition;
+    bool stopping = false;
+    std::thread worker;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(jobsMutex);
+        while (true)
+        {
+            jobsCondition.wait(lock, [this]
+                               { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+
+            Job job = std::move(jobs.front());
+            jobs.pop_front();
+            lock.unlock();
+
+            if (job.callback)
+            {
+                job.callback();
+            }
+            else
+            {
+                ScopedTimer timer(Stage::Encode);
+                if (!cv::imwrite(job.filename, job.image, {IMWRITE_JPEG_QUALITY, 95}))
+                {
+                    std::cerr << "Unable to write " << job.filename << std::endl;
+                }
+            }
+
+            lock.lock();
+        }
+    }
+
+public:
+    AsyncImageWriter() : worker(&AsyncImageWriter::run, this) {}
+
+    // Everything queued is still written before the thread exits
+    ~AsyncImageWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            stopping = true;
+        }
+        jobsCondition.notify_one();
+        worker.join();
+    }
+
+    // Queue image to be saved as a JPEG, it must not be changed afterwards so pass a clone of anything that gets reused
+    void write(const std::string &filename, const cv::Mat &image)
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.push_back({filename, image, nullptr});
+        }
+        jobsCondition.notify_one();
+    }
+
+    // Run callback on the writer thread once everything queued before it has been written
+    void whenDone(std::function<void()> callback)
+    {
         {
-            std::cerr << "Unable to open the file for reading." << std::endl;
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.push_back({std::string(), cv::Mat(), std::move(callback)});
         }
-        return value;
+        jobsCondition.notify_one();
     }
 };
 
-// Abstract YOLO Model Interface this way you can change out yolo models without losing functionality
-class IYoloModel
+// Remembers the sharpest crops of every face seen over the last CAPTUREWINDOWFRAMES frames.
+// Faces are told apart by the id the tracker gave them, so one blurry frame no longer throws away
+// the good crops the other players already had, a capture is ready as soon as each player has one sharp crop.
+class FaceCaptureWindow
 {
 public:
-    virtual void loadModel(const std::string &config, const std::string &weights) = 0;
-    virtual std::vector<cv::Rect> detectFaces(const cv::Mat &frame) = 0;
-    virtual ~IYoloModel() {}
-};
-
-// YOLO3 Model
-class YoloModelV3 : public IYoloModel
-{
-private:
-    dnn::Net net;
+    struct Crop
+    {
+        cv::Mat image; // owned copy, the frame it came from gets overwritten
+        double sharpness;
+    };
 
-public:
-    // load the YOLO model
-    void loadModel(const std::string &config, const std::string &weights) override
+    struct Track
     {
-        net = dnn::readNetFromDarknet(config, weights);
-        net.setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
-        net.setPreferableTarget(dnn::DNN_TARGET_CPU);
+        int id; // from the FaceTracker
+        int lastSeen;
+        int hits; // frames the face was seen in
+        std::vector<Crop> crops; // sharpest first, at most CROPSPERFACE
+    };
+
+    // Forget every face, used when a new round starts and after a capture was taken
+    void reset()
+    {
+        tracks.clear();
+        frameIndex = 0;
     }
 
-    std::vector<cv::Rect> detectFaces(const cv::Mat &frame) override
+    // Start a new frame, faces that have not been seen for the whole window are dropped
+    void beginFrame()
     {
+        frameIndex++;
+        tracks.erase(std::remove_if(tracks.begin(), tracks.end(), [this](const Track &track)
+                                    { return frameIndex - track.lastSeen > CAPTUREWINDOWFRAMES; }),
+                     tracks.end());
+    }
 
-        float confidenceThreshold = 0.9;
-        float nmsThreshold = 0.4;
-
-        // Prepare the frame for YOLO model
-        cv::Mat blob;
-        cv::dnn::blobFromImage(frame, blob, 1 / 255.0, cv::Size(FRAMEWIDTH, FRAMEHEIGHT), cv::Scalar(0, 0, 0), true, false);
-
-        // Set the blob as input to the network
-        net.setInput(blob);
-
-        // Forward pass to get the outputs
-        std::vector<cv::Mat> outs;
-        net.forward(outs, getOutputNames(net));
-
-        // Initialize vectors to hold detection results
-        std::vector<int> classIds;
-        std::vector<float> confidences;
-        std::vector<cv::Rect> boxes;
+    // Add the crop of face id in the current frame, only copied when it is one of the sharpest of that face
+    void add(int id, const cv::Mat &crop, double sharpness)
+    {
+        Track &track = trackFor(id);
+        track.lastSeen = frameIndex;
+        track.hits++;
 
-        // Process the output
-        for (size_t i = 0; i < outs.size(); ++i)
-        {
-            // Scan through all the bounding boxes output from the network and keep only the ones with high confidence scores
-            float *data = (float *)outs[i].data;
-            for (int j = 0; j < outs[i].rows; ++j, data += outs[i].cols)
-            {
-                float confidence = data[4];
-                if (confidence > confidenceThreshold)
-                {
-                    int centerX = (int)(data[0] * frame.cols);
-                    int centerY = (int)(data[1] * frame.rows);
-                    int width = (int)(data[2] * frame.cols);
-                    int height = (int)(data[3] * frame.rows);
-                    int left = centerX - width / 2;
-                    int top = centerY - height / 2;
-
-                    // Expand the bounding box by adding/subtracting expansionPixels
-                    left = std::max(0, left - EXPANSIONPIXELS);
-                    top = std::max(0, top - EXPANSIONPIXELS);
-                    width = std::min(frame.cols - left, width + 2 * EXPANSIONPIXELS);
-                    height = std::min(frame.rows - top, height + 2 * EXPANSIONPIXELS);
-
-                    classIds.push_back(classIds.size()); // Assuming only one class (face)
-                    confidences.push_back(confidence);
-                    boxes.push_back(cv::Rect(left, top, width, height));
-                }
-            }
-        }
+        if (track.crops.size() == CROPSPERFACE && sharpness <= track.crops.back().sharpness)
+            return;
+        if (track.crops.size() == CROPSPERFACE)
+            track.crops.pop_back();
 
-        // Apply Non-Maximum Suppression to eliminate redundant overlapping boxes
-        std::vector<int> indices;
-        cv::dnn::NMSBoxes(boxes, confidences, confidenceThreshold, nmsThreshold, indices);
+        auto position = std::find_if(track.crops.begin(), track.crops.end(), [sharpness](const Crop &other)
+                                     { return other.sharpness < sharpness; });
+        track.crops.insert(position, {crop.clone(), sharpness});
+    }
 
-        // Filter boxes based on NMS indices
-        std::vector<cv::Rect> faces;
-        for (int idx : indices)
+    // The numberPlayers most seen faces that have a crop above threshold, false while there are not enough of them yet.
+    // Only faces in the current frame count: a face that lost its tracker id is still in the window under the old one
+    // for a while, counting that too would pass one player off as two
+    bool selectCapture(int numberPlayers, double threshold, std::vector<const Track *> &selected) const
+    {
+        selected.clear();
+        for (const Track &track : tracks)
         {
-            faces.push_back(boxes[idx]);
+            if (track.lastSeen == frameIndex && !track.crops.empty() && track.crops.front().sharpness > threshold)
+                selected.push_back(&track);
         }
-
-        return faces; // Return the list of faces after NMS
+        if (numberPlayers <= 0 || selected.size() < (size_t)numberPlayers)
+            return false;
+
+        // Faces seen in more frames are less likely to be a one off false detection
+        std::stable_sort(selected.begin(), selected.end(), [](const Track *a, const Track *b)
+                         { return a->hits > b->hits; });
+        selected.resize(numberPlayers);
+        return true;
     }
 
-    // Get names of YOLO output layers
-    vector<cv::String> getOutputNames(const cv::dnn::Net &net)
+private:
+    std::vector<Track> tracks;
+    int frameIndex = 0;
+
+    Track &trackFor(int id)
     {
-        static vector<cv::String> names;
-        if (names.empty())
+        for (Track &track : tracks)
         {
-            // retrieve all layer names from the yolo network and resize the name vector accordingly
-            vector<int> outLayers = net.getUnconnectedOutLayers();
-            vector<cv::String> layersNames = net.getLayerNames();
-            names.resize(outLayers.size());
-            // put all the names in the names vector
-            for (size_t i = 0; i < outLayers.size(); ++i)
-            {
-                names[i] = layersNames[outLayers[i] - 1];
-            }
+            if (track.id == id)
+                return track;
         }
-        return names;
+        tracks.push_back({id, frameIndex, 0, {}});
+        return tracks.back();
     }
 };
 
-// YOLO4 Model
-class YoloModelV4 : public IYoloModel
+// Where the detector is in a round:
+// Idle         -> no game running, the camera is parked and the inference thread sleeps until the game state says there is one
+// Armed        -> looking for faces
+// Capturing    -> faces in this frame, they are cut out, scored for blur and kept in the capture window if they are sharp enough
+// Validating   -> handed to the writer once every player has a sharp crop in the window, otherwise back to Armed
+// AwaitingDone -> scanningComplete has been written, camera and inference sleep until done.txt says the images are generated
+enum class DetectorState
 {
-private:
-    dnn::Net net;
+    Idle,
+    Armed,
+    Capturing,
+    Validating,
+    AwaitingDone
+};
 
+// FaceRecognitionHandler for processing and recognizing faces
+class FaceRecognitionHandler : public WebcamHandler
+{
 public:
-    void loadModel(const std::string &config, const std::string &weights) override
-    {
-        net = dnn::readNetFromDarknet(config, weights);
-        net.setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
-        net.setPreferableTarget(dnn::DNN_TARGET_CPU);
-    }
+    int numberPlayers = 0;
+    int gameStart = 0;
+    bool readyToStart = false;
+    DetectorState detectorState = DetectorState::Idle;
 
-    std::vector<cv::Rect> detectFaces(const cv::Mat &frame) override
-    {
+    // Faces in the current frame and their tracker ids, the buffers keep room for MAXFACES so detecting never allocates
+    std::vector<cv::Rect> faces = std::vector<cv::Rect>(MAXFACES);
+    std::vector<int> faceIds = std::vector<int>(MAXFACES);
 
-        float confidenceThreshold = 0.5;
-        float nmsThreshold = 0.4;
+    // Follows the faces between detector runs, framesSinceDetection counts the frames it did so
+    FaceTracker faceTracker;
+    int framesSinceDetection = 0;
 
-        // Prepare the frame for YOLO model
-        cv::Mat blob;
-        cv::dnn::blobFromImage(frame, blob, 1 / 255.0, cv::Size(FRAMEWIDTH, FRAMEHEIGHT), cv::Scalar(0, 0, 0), true, false);
+    // Detector runs on the region around the known faces since the last one on the full frame
+    int detectionsSinceFullFrame = 0;
+    std::vector<cv::Rect> regionFaces = std::vector<cv::Rect>(MAXFACES);
 
-        // Set the blob as input to the network
-        net.setInput(blob);
+    // Sharpest crops of every face over the last frames, and the ones picked for the capture
+    FaceCaptureWindow captureWindow;
+    std::vector<const FaceCaptureWindow::Track *> selectedFaces;
+    cv::Mat grayFace; // scratch space for checkBluriness
+    AsyncImageWriter imageWriter;
+    std::string facePrefix; // goes in front of the face_N.jpg names, benchreplay keeps its captures apart from a real game with it
 
-        // Forward pass to get the outputs
-        std::vector<cv::Mat> outs;
-        net.forward(outs, getOutputNames(net));
+    // Game state from the bridge, and where the detector tells it the faces are in
+    GameChannel &channel;
+
+    FaceRecognitionHandler(int camIndex, std::unique_ptr<IYoloModel> model, GameChannel &channel, const CaptureConfig &config = CaptureConfig())
+        : WebcamHandler(camIndex, std::move(model), config), channel(channel)
+    {
+    }
+
+    void stop() override
+    {
+        WebcamHandler::stop();
+        channel.game.close();
+    }
 
-        // Initialize vectors to hold detection results
-        std::vector<int> classIds;
-        std::vector<float> confidences;
-        std::vector<cv::Rect> boxes;
+    void processFrame(Mat &frame) override
+    {
+        // Take the state the bridge published, a single atomic load
+        GameStateSnapshot state = channel.game.load();
+        numberPlayers = state.numberPlayers;
+        gameStart = state.gameStart;
+        readyToStart = state.readyToStart();
+
+        // The game got reset from the outside in the middle of a round
+        if (!readyToStart && detectorState == DetectorState::Armed)
+        {
+            detectorState = DetectorState::Idle;
+        }
 
-        // Process the output
-        for (size_t i = 0; i < outs.size(); ++i)
+        switch (detectorState)
         {
-            // Scan through all the bounding boxes output from the network and keep only the ones with high confidence scores
-            float *data = (float *)outs[i].data;
-            for (int j = 0; j < outs[i].rows; ++j, data += outs[i].cols)
+        case DetectorState::Idle:
+            waitForGameStart();
+            // This frame was taken before the game started, start looking at the next one
+            return;
+
+        case DetectorState::Armed:
+            // An empty, still room does not need the network, the faces from the last frame keep it running while anyone is there
+            if (shouldRunInference(frame, !faces.empty()))
             {
-                float confidence = data[4];
-                if (confidence > confidenceThreshold)
-                {
-                    int centerX = (int)(data[0] * frame.cols);
-                    int centerY = (int)(data[1] * frame.rows);
-                    int width = (int)(data[2] * frame.cols);
-                    int height = (int)(data[3] * frame.rows);
-                    int left = centerX - width / 2;
-                    int top = centerY - height / 2;
-
-                    // Expand the bounding box by adding/subtracting expansionPixels
-                    left = std::max(0, left - EXPANSIONPIXELS);
-                    top = std::max(0, top - EXPANSIONPIXELS);
-                    width = std::min(frame.cols - left, width + 2 * EXPANSIONPIXELS);
-                    height = std::min(frame.rows - top, height + 2 * EXPANSIONPIXELS);
-
-                    classIds.push_back(classIds.size()); // Assuming only one class (face)
-                    confidences.push_back(confidence);
-                    boxes.push_back(cv::Rect(left, top, width, height));
-                }
+                detect(frame);
             }
+            break;
+
+        default:
+            break;
         }
 
-        // Apply Non-Maximum Suppression to eliminate redundant overlapping boxes
-        std::vector<int> indices;
-        cv::dnn::NMSBoxes(boxes, confidences, confidenceThreshold, nmsThreshold, indices);
+        if (detectorState == DetectorState::Capturing)
+        {
+            CheckAndSafeFaces(faces, faceIds, frame);
+        }
+        if (detectorState == DetectorState::Validating)
+        {
+            logisch();
+        }
 
-        // Filter boxes based on NMS indices
-        std::vector<cv::Rect> faces;
-        for (int idx : indices)
+        // If desired, show the frame with detected faces in a window
+        if (showFrame)
         {
-            faces.push_back(boxes[idx]);
+            imshow("Detected Faces", frame);
+            waitKey(1); // Wait for a key press for a short duration to update the window
         }
 
-        return faces; // Return the list of faces after NMS
+        if (detectorState == DetectorState::AwaitingDone)
+        {
+            waitForDone();
+        }
     }
 
-    // Get names of YOLO output layers
-    vector<cv::String> getOutputNames(const cv::dnn::Net &net)
+    // Park the camera and this thread until the game state says a game with players has started
+    void waitForGameStart()
     {
-        static vector<cv::String> names;
-        if (names.empty())
+        pauseCapture();
+        GameStateSnapshot state = channel.game.waitUntil([](const GameStateSnapshot &snapshot)
+                                                      { return snapshot.readyToStart(); });
+        if (state.readyToStart())
         {
-            // retrieve all layer names from the yolo network and resize the name vector accordingly
-            vector<int> outLayers = net.getUnconnectedOutLayers();
-            vector<cv::String> layersNames = net.getLayerNames();
-            names.resize(outLayers.size());
-            // put all the names in the names vector
-            for (size_t i = 0; i < outLayers.size(); ++i)
-            {
-                names[i] = layersNames[outLayers[i] - 1];
-            }
+            std::cout << "Game started, looking for " << state.numberPlayers << " faces" << std::endl;
+            captureWindow.reset();
+            faceTracker.reset();
+            motionGate.reset();
+            faces.clear();
+            detectorState = DetectorState::Armed;
+            resumeCapture();
         }
-        return names;
     }
-};
-
-// YOLOv8 Model
-class YoloModelV8 : public IYoloModel
-{
-private:
-    dnn::Net net;
-    float confThreshold;
-    float nmsThreshold;
-
-public:
-    YoloModelV8(float confThreshold = 0.45, float nmsThreshold = 0.5)
-        : confThreshold(confThreshold), nmsThreshold(nmsThreshold) {}
 
-    void loadModel(const std::string &modelPath, const std::string & /*configPath*/) override
+    // Look for the players in the frame, moves on to Capturing as soon as there is any face to keep a crop of
+    void detect(Mat &frame)
     {
-        this->net = cv::dnn::readNet(modelPath); // Only uses the model path
-        net.setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
-        net.setPreferableTarget(dnn::DNN_TARGET_CPU);
-    }
-    std::vector<cv::Rect> detectFaces(const cv::Mat &frame) override
-    {
-        std::vector<cv::Rect> boxes;
-        std::vector<float> confidences;
+        ScopedTimer timer(Stage::Detect);
 
-        // Create a blob from the input frame
-        Mat blob;
-        cv::dnn::blobFromImage(frame, blob, 1 / 255.0, Size(640, 640), Scalar(0, 0, 0), true, false);
-        net.setInput(blob);
+        // The detector only runs every DETECTIONINTERVAL frames, or earlier when the tracker lost someone
+        framesSinceDetection++;
+        bool tracked = framesSinceDetection < DETECTIONINTERVAL && faceTracker.propagate(frame);
+        if (!tracked)
+        {
+            runDetector(frame);
+            faceTracker.update(frame, faces.data(), faces.size());
+            framesSinceDetection = 0;
+        }
 
-        // Forward pass to get the outputs
-        std::vector<Mat> outs;
-        net.forward(outs, net.getUnconnectedOutLayersNames());
+        // Resizing within the reserved capacity does not allocate
+        faces.resize(MAXFACES);
+        faceIds.resize(MAXFACES);
+        size_t count = faceTracker.getFaces(faces.data(), faceIds.data(), MAXFACES);
+        faces.resize(count);
+        faceIds.resize(count);
+        std::cout << "Number of faces " << (tracked ? "tracked: " : "found: ") << faces.size() << std::endl;
 
-        for (auto &out : outs)
+        captureWindow.beginFrame();
+        if (!faces.empty())
         {
-            std::cout << "Output size: " << out.size << std::endl;
-            for (int i = 0; i < out.rows; ++i)
-            {
-                float *data = out.ptr<float>(i);
-                float confidence = data[1];
-                std::cout << "Detection " << i << ": Confidence = " << confidence << std::endl;
-            }
+            detectorState = DetectorState::Capturing;
         }
 
-        // Process each output layer
-        for (auto &out : outs)
+        // Iterate over all detected faces and draw rectangles around them, if wanted
+        if (showFrame)
         {
-            // The output should have the shape [number_of_detections, 6]
-            // Each detection has the format [classId, confidence, x, y, width, height]
-            for (int i = 0; i < out.rows; ++i)
+            for (const auto &face : faces)
             {
-                float *detection = out.ptr<float>(i);
-                float confidence = detection[1];
-
-                // Filter out weak detections by ensuring the confidence is greater than a minimum threshold
-                if (confidence > this->confThreshold)
-                {
-                    int centerX = static_cast<int>(detection[2] * frame.cols);
-                    int centerY = static_cast<int>(detection[3] * frame.rows);
-                    int width = static_cast<int>(detection[4] * frame.cols);
-                    int height = static_cast<int>(detection[5] * frame.rows);
-                    int left = centerX - width / 2;
-                    int top = centerY - height / 2;
-
-                    // Add the bounding box and confidence to their respective vectors
-                    boxes.push_back(cv::Rect(left, top, width, height));
-                    confidences.push_back(confidence);
-                }
+                rectangle(frame, face, Scalar(0, 0, 255), 2); // Red rectangle with thickness of 2
             }
         }
+    }
 
-        // Apply Non-Maximum Suppression to eliminate redundant overlapping boxes
-        std::vector<int> indices;
-        cv::dnn::NMSBoxes(boxes, confidences, this->confThreshold, this->nmsThreshold, indices);
-
-        // Use indices to add the final set of bounding boxes to faces
-        std::vector<cv::Rect> faces;
-        for (int idx : indices)
+    // Run the network on the frame, at full resolution when enough people are there for a capture
+    void runDetector(const Mat &frame)
+    {
+        // Faces hardly move between two detector runs, so looking around the last ones is usually enough
+        if (regionDetection && !faces.empty() && ++detectionsSinceFullFrame < FULLFRAMEINTERVAL && detectInRegion(frame))
         {
-            faces.push_back(boxes[idx]);
+            return;
         }
+        detectionsSinceFullFrame = 0;
 
-        return faces;
-    }
-};
-
-// WebcamHandler to manage webcam capture
-class WebcamHandler
-{
-protected:
-    VideoCapture cap;
-    std::unique_ptr<IYoloModel> model;
-    std::thread processingThread; // Thread for asynchronous processing
-
-public:
-    explicit WebcamHandler(int camIndex, std::unique_ptr<IYoloModel> model)
-        : cap(camIndex, CAP_V4L), model(std::move(model))
-    {
-        // cap.set(cv::CAP_PROP_EXPOSURE, -1);    // Auto exposure
-        cap.set(cv::CAP_PROP_BRIGHTNESS, 208); // Adjust as necessary
-        // cap.set(cv::CAP_PROP_CONTRAST, 128);   // Adjust as necessary
+        // Detect faces in the frame, resizing within the reserved capacity does not allocate
+        faces.resize(MAXFACES);
+        faces.resize(model->detectFaces(frame, faces.data(), faces.size()));
 
-        if (!cap.isOpened())
+        // Redo this frame at full resolution so the crops are as good as possible
+        if (multiScaleDetection && faces.size() >= (size_t)numberPlayers)
         {
-            cerr << "Error: Unable to open the webcam." << endl;
-            exit(-1);
+            model->setDetectionScale(DetectionScale::Capture);
+            faces.resize(MAXFACES);
+            faces.resize(model->detectFaces(frame, faces.data(), faces.size()));
+            model->setDetectionScale(DetectionScale::Presence);
         }
     }
 
-    void captureAndProcess()
+    // Run the network at native resolution on the region around the faces of the last frame. Returns false, leaving
+    // faces alone, when the region is not worth it or someone could not be found in it anymore
+    bool detectInRegion(const Mat &frame)
     {
-        Mat frame;
-        while (true)
+        cv::Rect region;
+        for (const auto &face : faces)
         {
-            cap >> frame;
-            if (frame.empty())
+            region |= face;
+        }
+        int marginX = (int)(region.width * ROIMARGIN);
+        int marginY = (int)(region.height * ROIMARGIN);
+        region = cv::Rect(region.x - marginX, region.y - marginY, region.width + 2 * marginX, region.height + 2 * marginY) &
+                 cv::Rect(0, 0, frame.cols, frame.rows);
+
+        // Grow it to one of a few fixed sizes, so the network is not set up for a new input size on every run. At native
+        // resolution anything bigger than the presence input costs more than looking at the full frame
+        cv::Size presenceSize = model->getPresenceInputSize();
+        cv::Size inputSize;
+        for (cv::Size size : REGIONINPUTSIZES)
+        {
+            if (size.width >= region.width && size.height >= region.height && size.width <= frame.cols &&
+                size.height <= frame.rows && size.area() <= presenceSize.area())
+            {
+                inputSize = size;
                 break;
-
-            processFrame(frame);
+            }
+        }
+        if (inputSize.empty())
+            return false;
+        int x = std::min(std::max(0, region.x + region.width / 2 - inputSize.width / 2), frame.cols - inputSize.width);
+        int y = std::min(std::max(0, region.y + region.height / 2 - inputSize.height / 2), frame.rows - inputSize.height);
+        region = cv::Rect(cv::Point(x, y), inputSize);
+
+        size_t previousFaces = faces.size();
+        regionFaces.resize(MAXFACES);
+        model->setDetectionScale(DetectionScale::Native);
+        regionFaces.resize(model->detectFaces(frame(region), regionFaces.data(), regionFaces.size()));
+        model->setDetectionScale(DetectionScale::Presence);
+        if (regionFaces.size() < previousFaces)
+            return false;
+
+        // Boxes come back relative to the region
+        faces.clear();
+        for (auto &face : regionFaces)
+        {
+            faces.push_back(cv::Rect(face.x + region.x, face.y + region.y, face.width, face.height));
         }
+        return true;
     }
 
-    virtual void processFrame(Mat &frame)
+    // Cut out every face and score its sharpness right away, only the sharpest ones are copied into the capture window
+    void CheckAndSafeFaces(const vector<cv::Rect> &boxes, const vector<int> &ids, const cv::Mat &frame)
     {
-        // Default implementation does nothing
-        // Override in derived classes
+        // Crop and process each detected face
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            // Adjust the rectangle to be slightly smaller to avoid saving the green box
+            cv::Rect adjustedFace = boxes[i];
+            int shrinkAmount = 3; // Shrink the rectangle by 1 pixel on all sides
+            adjustedFace.x += shrinkAmount;
+            adjustedFace.y += shrinkAmount;
+            adjustedFace.width -= 2 * shrinkAmount; // 2 * shrinkAmount because we're shrinking from both sides
+            adjustedFace.height -= 2 * shrinkAmount;
+
+            // Ensure the adjusted rectangle remains within the frame boundaries
+            adjustedFace &= cv::Rect(0, 0, frame.cols, frame.rows);
+
+            // A sliver of a face at the edge of the frame is no use to the generator, and an empty crop would throw in the blur check
+            if (adjustedFace.width < MINFACESIZE || adjustedFace.height < MINFACESIZE)
+                continue;
+
+            // Perform cropping with the adjusted rectangle, this is only a view into the frame until the window keeps it
+            cv::Mat croppedFace = frame(adjustedFace);
+            captureWindow.add(ids[i], croppedFace, checkBluriness(croppedFace));
+        }
+        detectorState = DetectorState::Validating;
     }
-};
-
-// FaceRecognitionHandler for processing and recognizing faces
-class FaceRecognitionHandler : public WebcamHandler
-{
-public:
-    int numberPlayers = 0;
-    int gameStart = 0;
-    bool readyToStart = false;
-    bool facesCaptured = false;
 
-    using WebcamHandler::WebcamHandler;
-
-    void processFrame(Mat &frame) override
+    // Variance of the Laplacian of the face, the lower it is the blurrier the face
+    double checkBluriness(const cv::Mat &image)
     {
+        // Single pass integer kernel, same number as cv::Laplacian + meanStdDev without the full size double image
+        ScopedTimer timer(Stage::BlurScore);
+        return sharpnessScore(image, grayFace);
+    }
 
-        if (readyToStart)
+    // Take the capture once every player has a sharp enough crop in the window, otherwise go back to looking for more
+    void logisch()
+    {
+        if (!captureWindow.selectCapture(numberPlayers, BLURRYNESSTHRESHHOLD, selectedFaces))
         {
-            // Detect faces in the frame
-            auto faces = model->detectFaces(frame);
-
-            // Iterate over all detected faces and draw rectangles around them, if wanted
-            if (showFrame)
-            {
-                for (const auto &face : faces)
-                {
-                    rectangle(frame, face, Scalar(0, 0, 255), 2); // Red rectangle with thickness of 2
-                }
-            }
-            CheckAndSafeFaces(faces, frame);
+            detectorState = DetectorState::Armed;
+            return;
         }
 
-        logisch();
-
-        // If desired, show the frame with detected faces in a window
-        if (showFrame)
+        // Only now the faces get encoded, on the writer thread. It shares the copies the window made, so nothing is copied again
+        for (size_t i = 0; i < selectedFaces.size(); ++i)
         {
-            imshow("Detected Faces", frame);
-            waitKey(1); // Wait for a key press for a short duration to update the window
+            const FaceCaptureWindow::Crop &best = selectedFaces[i]->crops.front();
+            std::cout << "blurryness of face number " << i << " is " << best.sharpness << std::endl;
+
+            // Generate a unique filename
+            stringstream filename;
+            // UNCOMMENT IF YOU WANT TO PUT IN FOLDER INSTEAD
+            // filename << OUTPUTIMAGESLOCATION << "/face_" << i+1 << ".jpg";
+            filename << facePrefix << "face_" << i + 1 << ".jpg";
+            imageWriter.write(filename.str(), best.image);
         }
+        selectedFaces.clear();
+        captureWindow.reset();
+
+        // The generator picks the faces up as soon as it sees scanningComplete, so that is posted after the last face
+        imageWriter.whenDone([this]
+                             {
+            std::cout << "Scanning complete" << std::endl;
+            channel.post(SCANNINGCOMPLETE); });
+        detectorState = DetectorState::AwaitingDone;
     }
 
-    // Check if the correct amount of faces have been detected
-    void CheckAndSafeFaces(vector<cv::Rect> boxes, const cv::Mat &frame)
+    // Park the camera and this thread until the generator is done, generating the images takes minutes and nothing needs the CPU meanwhile
+    void waitForDone()
     {
-        std::cout << "Number of faces found: " << boxes.size() << std::endl;
-        if (boxes.size() >= numberPlayers && !facesCaptured)
+        std::cout << "Waiting for done.txt to be updated..." << std::endl;
+        pauseCapture();
+        GameStateSnapshot state = channel.game.waitUntil([](const GameStateSnapshot &snapshot)
+                                                      { return snapshot.done != 0; });
+        if (!state.done)
         {
-            std::cout << "Number of faces found: " << boxes.size() << std::endl;
+            // Woken up because we are shutting down
+            return;
+        }
 
-            // Crop and process each detected face
-            for (size_t i = 0; i < boxes.size(); ++i)
-            {
-                // Adjust the rectangle to be slightly smaller to avoid saving the green box
-                cv::Rect adjustedFace = boxes[i];
-                int shrinkAmount = 3; // Shrink the rectangle by 1 pixel on all sides
-                adjustedFace.x += shrinkAmount;
-                adjustedFace.y += shrinkAmount;
-                adjustedFace.width -= 2 * shrinkAmount; // 2 * shrinkAmount because we're shrinking from both sides
-                adjustedFace.height -= 2 * shrinkAmount;
-
-                // Ensure the adjusted rectangle remains within the frame boundaries
-                adjustedFace.width = std::max(0, adjustedFace.width);
-                adjustedFace.height = std::max(0, adjustedFace.height);
-
-                // Perform cropping with the adjusted rectangle
-                cv::Mat croppedFace = frame(adjustedFace);
-
-                // Generate a unique filename
-                stringstream filename;
-                // UNCOMMENT IF YOU WANT TO PUT IN FOLDER INSTEAD
-                // filename << OUTPUTIMAGESLOCATION << "/face_" << i+1 << ".jpg";
-                filename << "face_" << i + 1 << ".jpg";
-
-                // Save the cropped face to a file
-                cv::imwrite(filename.str(), croppedFace, {IMWRITE_JPEG_QUALITY, 95});
-            }
-            facesCaptured = true;
-        };
+        // The bridge resets all the files right after done, until those writes come in act as if they already did
+        std::cout << "Resetting self" << std::endl;
+        numberPlayers = 0;
+        gameStart = 0;
+        readyToStart = false;
+        channel.game.store(GameStateSnapshot());
+        detectorState = DetectorState::Idle;
+        // Straight on to waiting for the next game, the camera stays parked until it starts
+        waitForGameStart();
     }
+};
 
-    double checkBluriness(const cv::Mat &image)
+// Load the images listed in a calibration list, one path per line. A longer list is thinned out evenly to INT8CALIBRATIONIMAGES
+std::vector<cv::Mat> readCalibrationImages(const std::string &list)
+{
+    std::vector<std::string> paths;
+    std::ifstream listFile(list);
+    std::string line;
+    while (std::getline(listFile, line))
+    {
+        if (!line.empty())
+            paths.push_back(line);
+    }
+
+    std::vector<cv::Mat> images;
+    size_t used = std::min<size_t>(paths.size(), INT8CALIBRATIONIMAGES);
+    for (size_t i = 0; i < used; ++i)
+    {
+        const std::string &path = paths[i * paths.size() / used];
+        cv::Mat image = cv::imread(path);
+        if (image.empty())
+            std::cerr << "Unable to read calibration image " << path << std::endl;
+        else
+            images.push_back(image);
+    }
+    return images;
+}
+
+// Lets herken run as its own program next to mqtt: the game state is read from the files the bridge writes, and what the
+// detector posts on the channel is written to files for the bridge to pick up. faceinator.cpp runs without it
+class DetectorFileShim
+{
+public:
+    explicit DetectorFileShim(GameChannel &channel) : channel(channel)
     {
-        // Convert the image to grayscale
-        cv::Mat gray;
-        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        // Only re-read the game state when one of its files was actually written
+        watcher.onChange(std::string(PLAYERSKEY) + ".txt", [this]
+                         { readGameState(); });
+        watcher.onChange(std::string(STARTKEY) + ".txt", [this]
+                         { readGameState(); });
+        watcher.onChange(std::string(DONEKEY) + ".txt", [this]
+                         { readGameState(); });
+        readGameState();
+        watcher.start();
+        forwarder = std::thread(&DetectorFileShim::forwardEvents, this);
+    }
 
-        // Compute the Laplacian of the grayscale image
-        cv::Mat laplacian;
-        cv::Laplacian(gray, laplacian, CV_64F);
+    ~DetectorFileShim()
+    {
+        stopping = true;
+        channel.post(0);
+        forwarder.join();
+    }
 
-        // Compute the variance of Laplacian
-        cv::Scalar mean, stddev;
-        cv::meanStdDev(laplacian, mean, stddev);
+    DetectorFileShim(const DetectorFileShim &) = delete;
+    DetectorFileShim &operator=(const DetectorFileShim &) = delete;
 
-        double variance = stddev.val[0] * stddev.val[0];
+private:
+    GameChannel &channel;
+    FileWatcher watcher;
+    std::thread forwarder;
+    std::atomic<bool> stopping{false};
 
-        return variance;
+    // Write every event the detector posts to its file, sleeps in poll() in between
+    void forwardEvents()
+    {
+        struct pollfd fds = {channel.fd(), POLLIN, 0};
+        while (!stopping)
+        {
+            if (poll(&fds, 1, -1) <= 0)
+                continue;
+            uint32_t events = channel.take();
+            if (events & DETECTORREADY)
+                FileHandler::writeToFile(channel.detectorReady() ? "1" : "0", READYKEY);
+            if (events & SCANNINGCOMPLETE)
+                FileHandler::writeToFile("1", SCANNINGKEY);
+            // runDetector() already wrote it to its file
+            if (events & LATENCYREPORT)
+                channel.takeLatencyReport();
+        }
     }
 
-    // Check game state from files
-    void CheckGameState()
+    // Read the game state from its files and publish it to the detector, runs on the watcher thread
+    void readGameState()
     {
+        int players = 0;
+        int started = 0;
+
         // Read content from files
         std::string temp1 = FileHandler::readFromFile(PLAYERSKEY);
         std::string temp2 = FileHandler::readFromFile(STARTKEY);
+        std::string temp3 = FileHandler::readFromFile(DONEKEY);
 
         // Trim leading and trailing whitespace
         temp1.erase(std::remove_if(temp1.begin(), temp1.end(), ::isspace), temp1.end());
         temp2.erase(std::remove_if(temp2.begin(), temp2.end(), ::isspace), temp2.end());
+        temp3.erase(std::remove_if(temp3.begin(), temp3.end(), ::isspace), temp3.end());
 
         try
         { // Another edge case scenario where the file might be empty, if so, return 0
             if (temp1.empty())
             {
-                numberPlayers = 0;
+                players = 0;
             }
             else
             { // The value in the file is a string so make it an int
-                numberPlayers = std::stoi(temp1);
+                players = std::stoi(temp1);
             }
             if (temp2.empty())
             {
-                gameStart = 0;
+                started = 0;
             }
             else
             {
-                gameStart = std::stoi(temp2);
+                started = std::stoi(temp2);
             }
         }
         catch (const std::invalid_argument &e)
@@ -551,98 +1864,108 @@ public:
             return;
         }
 
-        // Check if game is ready to start
-        if (gameStart != 0 && numberPlayers != 0)
-        {
-            readyToStart = true;
-        }
-        else
-        {
-            readyToStart = false;
-        }
-        // std::cout << "Number of players: " << numberPlayers << " Game Started? " << gameStart << " Ready To start? " << readyToStart << std::endl;
+        GameStateSnapshot state;
+        state.numberPlayers = players;
+        state.gameStart = started;
+        state.done = (temp3 == "1");
+        channel.game.store(state);
     }
+};
 
-    void logisch()
+// Same as DetectorFileShim, but through the shared memory segment mqtt also maps. The game state is copied into the channel
+// whenever the bridge changes it
+class DetectorSharedShim
+{
+public:
+    DetectorSharedShim(GameChannel &channel, SharedSegment &segment)
+        : channel(channel), segment(segment), watcher(segment, [this](const SharedGame &game)
+                                                      { copyGameState(game); })
     {
-        // Check if the game has started and how many players there are
-        this->CheckGameState();
-        if (facesCaptured)
-        {
-            // When there are the correct amount of faces detected check if they are usable
-            bool isAFaceBlurry = false;
+        forwarder = std::thread(&DetectorSharedShim::forwardEvents, this);
+    }
 
-            for (int i = 0; i < numberPlayers; i++)
-            {
-                std::string filename;
-                float blurrness;
-                filename = "face_" + std::to_string(i + 1) + ".jpg";
-                cv::Mat face = cv::imread(filename);
-                blurrness = checkBluriness(face);
-                std::cout << "blurryness of face number " << i << " is " << blurrness << std::endl;
-                if (blurrness <= BLURRYNESSTHRESHHOLD)
-                {
-                    // If one face is too blurry stop checking the rest.
-                    isAFaceBlurry = true;
-                    break;
-                }
-            }
-            if (isAFaceBlurry)
-            {
-                // Delete captured faces when they are not up to standard
-                for (int i = 0; i < numberPlayers; i++)
-                {
-                    std::string filename;
-                    filename = "face_" + std::to_string(i + 1) + ".jpg";
-                    std::remove(filename.c_str());
-                } // Reset the variable to retry capturing all faces
-                facesCaptured = false;
-            }
-            else
-            {
-                // If the faces were captured correctly, tell the system that it has been completed and reset to an idle state
-                std::cout << "Scanning complete, writing to file..." << std::endl;
-                FileHandler::writeToFile("1", SCANNINGKEY);
+    ~DetectorSharedShim()
+    {
+        stopping = true;
+        channel.post(0);
+        forwarder.join();
+    }
 
-                // Wait for done.txt to be updated to 1
-                bool done = false;
-                while (!done)
-                {
-                    std::string temp = FileHandler::readFromFile(DONEKEY);
-                    // Trim leading and trailing whitespace
-                    temp.erase(std::remove_if(temp.begin(), temp.end(), ::isspace), temp.end());
-                    // int donefile = std::stoi(temp);
-                    if (temp == "1")
-                    {
-                        done = true;
-                    }
-                    else
-                    {
-                        // std::cout << "Waiting for done.txt to be updated..." << std::endl;
-                        // sleep(1); // Wait for 5 seconds before checking again
-                    }
-                }
+    DetectorSharedShim(const DetectorSharedShim &) = delete;
+    DetectorSharedShim &operator=(const DetectorSharedShim &) = delete;
+
+private:
+    GameChannel &channel;
+    SharedSegment &segment;
+    GameStateSnapshot copied;
+    bool copiedOnce = false;
+    std::thread forwarder;
+    std::atomic<bool> stopping{false};
+    SharedSegmentWatcher watcher; // last, so its thread is gone before the members it uses
+
+    // Copy the game state into the channel, on the watcher thread. Only a change is copied, so the reset waitForDone()
+    // does on its own is not undone by a done that is still set
+    void copyGameState(const SharedGame &game)
+    {
+        if (copiedOnce && game.numberPlayers == copied.numberPlayers && game.gameStart == copied.gameStart && game.done == copied.done)
+            return;
+        copied.numberPlayers = game.numberPlayers;
+        copied.gameStart = game.gameStart;
+        copied.done = game.done;
+        channel.game.store(copied);
+        copiedOnce = true;
+    }
 
-                std::cout << "Resetting self" << std::endl;
-                facesCaptured = false;
-                numberPlayers = 0;
-                gameStart = 0;
-                readyToStart = false;
+    // Write every event the detector posts to the segment, sleeps in poll() in between
+    void forwardEvents()
+    {
+        struct pollfd fds = {channel.fd(), POLLIN, 0};
+        while (!stopping)
+        {
+            if (poll(&fds, 1, -1) <= 0)
+                continue;
+            uint32_t events = channel.take();
+            if (events & DETECTORREADY)
+            {
+                int ready = channel.detectorReady();
+                segment.update([ready](SharedGame &game)
+                               { game.detectorReady = ready; });
             }
+            if (events & SCANNINGCOMPLETE)
+                segment.update([](SharedGame &game)
+                               { game.scanningComplete = 1; });
+            if (events & LATENCYREPORT)
+                segment.writeLatencyReport(channel.takeLatencyReport());
         }
     }
 };
 
-int main()
+// Load the network and run the detector on the webcam until it stops delivering frames, the game state comes in through channel
+int runDetector(GameChannel &channel)
 {
     try
     {
+        // Not ready until the network has run once
+        channel.setDetectorReady(false);
+
         // Setup YOLO model
         auto yoloModel = std::make_unique<YoloModelV4>();
         yoloModel->loadModel(YOLO4CONFIG, YOLO4WEIGHTS);
+        if (int8Inference)
+        {
+            yoloModel->useInt8(readCalibrationImages(INT8CALIBRATIONLIST));
+        }
+        yoloModel->warmUp();
+        channel.setDetectorReady(true);
+
+        // Always kept in its file, the channel takes it on to the bridge for the server
+        LatencyReporter latencyReporter(LATENCYINTERVAL, [&channel](const std::string &report)
+                                        {
+            FileHandler::replaceFile(report, LATENCYKEY);
+            channel.postLatencyReport(report); });
 
         // Start webcam and face recognition
-        FaceRecognitionHandler handler(-1, std::move(yoloModel)); // Use camera index 0
+        FaceRecognitionHandler handler(-1, std::move(yoloModel), channel); // Use camera index 0
         handler.captureAndProcess();
     }
     catch (const std::exception &e)
@@ -653,3 +1976,25 @@ int main()
 
     return 0;
 }
+
+#ifndef HERKEN_NO_MAIN
+// herken on its own, it talks to the mqtt program through shared memory or the text files
+int main()
+{
+    GameChannel channel;
+    std::unique_ptr<SharedSegment> segment;
+    std::unique_ptr<DetectorSharedShim> sharedShim;
+    std::unique_ptr<DetectorFileShim> fileShim;
+    if (sharedMemoryIpc)
+        segment.reset(new SharedSegment());
+    if (segment && segment->isOpened())
+    {
+        sharedShim.reset(new DetectorSharedShim(channel, *segment));
+    }
+    else
+    {
+        fileShim.reset(new DetectorFileShim(channel));
+    }
+    return runDetector(channel);
+}
+#endif
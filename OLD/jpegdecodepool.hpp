@@ -0,0 +1,127 @@
+// Decodes the raw MJPEG buffers of a webcam on a few worker threads
+//
+// A single core can not decode 1280 wide JPEGs at the frame rate the camera delivers them, so the capture thread only
+// grabs the compressed buffer and submits it here. Like the latest frame slot the newest frame wins: a buffer that is
+// still waiting when the next one comes in is dropped, and a decoded frame that got overtaken by a newer one is never
+// handed out, so the consumer always sees the frames in order.
+
+#ifndef JPEGDECODEPOOL_HPP
+#define JPEGDECODEPOOL_HPP
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class JpegDecodePool
+{
+public:
+    // publish is called with every decoded frame that is newer than the last one, one call at a time.
+    // It may swap the frame out, the worker decodes its next frame into whatever is left behind.
+    JpegDecodePool(int threads, std::function<void(cv::Mat &)> publish) : publish(std::move(publish))
+    {
+        for (int i = 0; i < std::max(1, threads); ++i)
+        {
+            workers.emplace_back(&JpegDecodePool::run, this);
+        }
+    }
+
+    ~JpegDecodePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            stopping = true;
+        }
+        pendingCondition.notify_all();
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    JpegDecodePool(const JpegDecodePool &) = delete;
+    JpegDecodePool &operator=(const JpegDecodePool &) = delete;
+
+    // Queue a compressed frame, it is swapped out of raw and raw gets an old buffer back to grab the next frame into.
+    // Returns true when a frame nobody started decoding yet got replaced.
+    bool submit(cv::Mat &raw)
+    {
+        bool replaced;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            replaced = hasPending;
+            cv::swap(pending, raw);
+            pendingSequence = ++submitted;
+            hasPending = true;
+        }
+        pendingCondition.notify_one();
+        return replaced;
+    }
+
+    // Decoded frames thrown away because a newer one was published first
+    uint64_t overtaken() const
+    {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        return overtakenFrames;
+    }
+
+private:
+    std::function<void(cv::Mat &)> publish;
+    std::vector<std::thread> workers;
+
+    std::mutex pendingMutex;
+    std::condition_variable pendingCondition;
+    cv::Mat pending;
+    uint64_t pendingSequence = 0;
+    uint64_t submitted = 0;
+    bool hasPending = false;
+    bool stopping = false;
+
+    mutable std::mutex publishMutex;
+    uint64_t publishedSequence = 0;
+    uint64_t overtakenFrames = 0;
+
+    void run()
+    {
+        // Every worker keeps its own buffers, after the first frames nothing is allocated anymore
+        cv::Mat raw;
+        cv::Mat decoded;
+        while (true)
+        {
+            uint64_t sequence;
+            {
+                std::unique_lock<std::mutex> lock(pendingMutex);
+                pendingCondition.wait(lock, [this]
+                                      { return stopping || hasPending; });
+                if (!hasPending)
+                    return;
+                cv::swap(raw, pending);
+                sequence = pendingSequence;
+                hasPending = false;
+            }
+
+            cv::imdecode(raw, cv::IMREAD_COLOR, &decoded);
+            if (decoded.empty())
+            {
+                std::cerr << "Unable to decode a frame from the webcam." << std::endl;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(publishMutex);
+            if (sequence < publishedSequence)
+            {
+                overtakenFrames++;
+                continue;
+            }
+            publishedSequence = sequence;
+            publish(decoded);
+        }
+    }
+};
+
+#endif
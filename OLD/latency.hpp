@@ -0,0 +1,260 @@
+// Per stage latency histograms for the detection pipeline
+//
+// Every thread records into histograms of its own, a thread only ever writes its own counters, so recording is a
+// couple of relaxed stores without locks or shared cache lines. The buckets are HDR style: 16 linear sub-buckets for
+// every power of two microseconds, so every value is kept within about 6% whether it took 20 us or 2 s.
+// LatencyReport adds the histograms of all threads together and turns them into percentiles, LatencyReporter makes
+// one every so many seconds for the MQTT bridge to forward to the server.
+
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class Stage
+{
+    Capture,    // waiting for and reading a frame from the webcam
+    Preprocess, // letterbox + blobFromImage
+    Forward,    // net.forward
+    Decode,     // turning the outputs into boxes
+    Nms,
+    BlurScore,
+    Encode, // JPEG encoding and writing a face
+    Detect, // a whole detect() call, its count gives the inference FPS
+    Count
+};
+
+inline const char *stageName(Stage stage)
+{
+    static const char *names[] = {"capture", "preprocess", "forward", "decode", "nms", "blurScore", "encode", "detect"};
+    return names[(int)stage];
+}
+
+constexpr int LATENCYSUBBUCKETBITS = 4;
+constexpr int LATENCYSUBBUCKETS = 1 << LATENCYSUBBUCKETBITS;
+constexpr int LATENCYBUCKETS = (32 - LATENCYSUBBUCKETBITS + 1) * LATENCYSUBBUCKETS; // up to 2^32 us, over an hour
+
+// Bucket a duration in microseconds falls in
+inline int latencyBucket(uint64_t micros)
+{
+    if (micros >= (1ull << 32))
+        return LATENCYBUCKETS - 1;
+    if (micros < LATENCYSUBBUCKETS)
+        return (int)micros;
+    int magnitude = 63 - __builtin_clzll(micros); // position of the highest bit, at least LATENCYSUBBUCKETBITS
+    int shift = magnitude - LATENCYSUBBUCKETBITS;
+    return (shift + 1) * LATENCYSUBBUCKETS + (int)((micros >> shift) - LATENCYSUBBUCKETS);
+}
+
+// Highest duration that still falls in bucket, used when reporting a percentile
+inline uint64_t latencyBucketLimit(int bucket)
+{
+    if (bucket < LATENCYSUBBUCKETS)
+        return bucket;
+    int shift = bucket / LATENCYSUBBUCKETS - 1;
+    uint64_t base = (uint64_t)(bucket % LATENCYSUBBUCKETS + LATENCYSUBBUCKETS) << shift;
+    return base + (1ull << shift) - 1;
+}
+
+// Histograms of a single thread, written only by that thread and read by whoever makes a report
+struct ThreadLatencies
+{
+    std::atomic<uint64_t> counts[(int)Stage::Count][LATENCYBUCKETS];
+
+    ThreadLatencies()
+    {
+        for (auto &stage : counts)
+            for (auto &count : stage)
+                count.store(0, std::memory_order_relaxed);
+    }
+
+    void record(Stage stage, uint64_t micros)
+    {
+        std::atomic<uint64_t> &count = counts[(int)stage][latencyBucket(micros)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// All threads that ever recorded something, the lock is only taken when a thread records for the first time and when reporting
+class LatencyRegistry
+{
+public:
+    static LatencyRegistry &instance()
+    {
+        static LatencyRegistry registry;
+        return registry;
+    }
+
+    ThreadLatencies &forThisThread()
+    {
+        thread_local ThreadLatencies *latencies = nullptr;
+        if (!latencies)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.emplace_back(new ThreadLatencies());
+            latencies = threads.back().get();
+        }
+        return *latencies;
+    }
+
+    // Sum of the histograms of all threads, totals[stage * LATENCYBUCKETS + bucket]
+    void sum(std::vector<uint64_t> &totals)
+    {
+        totals.assign((int)Stage::Count * LATENCYBUCKETS, 0);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &thread : threads)
+        {
+            for (int stage = 0; stage < (int)Stage::Count; ++stage)
+                for (int bucket = 0; bucket < LATENCYBUCKETS; ++bucket)
+                    totals[stage * LATENCYBUCKETS + bucket] += thread->counts[stage][bucket].load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::mutex mutex;
+    // Never freed, a thread that exits leaves its counts behind for the report
+    std::vector<std::unique_ptr<ThreadLatencies>> threads;
+};
+
+inline void recordLatency(Stage stage, uint64_t micros)
+{
+    LatencyRegistry::instance().forThisThread().record(stage, micros);
+}
+
+// Records how long the scope it lives in took
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Stage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        recordLatency(stage, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+private:
+    Stage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Percentiles of everything recorded since the previous report, as JSON
+class LatencyReport
+{
+public:
+    LatencyReport() : last(std::chrono::steady_clock::now())
+    {
+        LatencyRegistry::instance().sum(previous);
+    }
+
+    std::string make()
+    {
+        LatencyRegistry::instance().sum(current);
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - last).count();
+
+        std::ostringstream json;
+        json << "{\"seconds\":" << seconds << ",\"stages\":{";
+        uint64_t detections = 0;
+        for (int stage = 0; stage < (int)Stage::Count; ++stage)
+        {
+            // Only what happened in this interval
+            uint64_t count = 0;
+            for (int bucket = 0; bucket < LATENCYBUCKETS; ++bucket)
+            {
+                size_t i = stage * LATENCYBUCKETS + bucket;
+                interval[bucket] = current[i] - previous[i];
+                count += interval[bucket];
+            }
+            if ((Stage)stage == Stage::Detect)
+                detections = count;
+
+            json << (stage ? "," : "") << "\"" << stageName((Stage)stage) << "\":{\"count\":" << count
+                 << ",\"p50\":" << percentile(count, 0.50) << ",\"p95\":" << percentile(count, 0.95)
+                 << ",\"p99\":" << percentile(count, 0.99) << "}";
+        }
+        json << "},\"fps\":" << (seconds > 0 ? detections / seconds : 0) << "}";
+
+        previous.swap(current);
+        last = now;
+        return json.str();
+    }
+
+private:
+    std::vector<uint64_t> previous;
+    std::vector<uint64_t> current;
+    uint64_t interval[LATENCYBUCKETS];
+    std::chrono::steady_clock::time_point last;
+
+    // In microseconds, 0 when nothing was recorded
+    uint64_t percentile(uint64_t count, double fraction) const
+    {
+        if (count == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(fraction * (count - 1)) + 1;
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < LATENCYBUCKETS; ++bucket)
+        {
+            seen += interval[bucket];
+            if (seen >= rank)
+                return latencyBucketLimit(bucket);
+        }
+        return latencyBucketLimit(LATENCYBUCKETS - 1);
+    }
+};
+
+// Hands a LatencyReport to publish every interval seconds, in the background until it is destroyed
+class LatencyReporter
+{
+public:
+    LatencyReporter(int intervalSeconds, std::function<void(const std::string &)> publish)
+        : interval(intervalSeconds), publish(std::move(publish))
+    {
+        worker = std::thread(&LatencyReporter::run, this);
+    }
+
+    ~LatencyReporter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(stopMutex);
+            stopping = true;
+        }
+        stopCondition.notify_all();
+        worker.join();
+    }
+
+    LatencyReporter(const LatencyReporter &) = delete;
+    LatencyReporter &operator=(const LatencyReporter &) = delete;
+
+private:
+    std::chrono::seconds interval;
+    std::function<void(const std::string &)> publish;
+    LatencyReport report;
+    std::thread worker;
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopping = false;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(stopMutex);
+        while (!stopCondition.wait_for(lock, interval, [this]
+                                       { return stopping; }))
+        {
+            publish(report.make());
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,82 @@
+// Tells whether anything is moving in front of the camera, so the network does not have to look at an empty room
+//
+// Works on a small grey copy of the frame against a slowly updated background. Motion opens the gate straight away,
+// it only closes again after MOTIONHOLDFRAMES frames in a row with (almost) nothing changing. While open, a smaller
+// change than the one that opened it is enough to keep it open, so noise around the threshold does not make it flicker.
+
+#ifndef MOTIONGATE_HPP
+#define MOTIONGATE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+
+constexpr int MOTIONWIDTH = 160;             // width the frames are shrunk to before comparing
+constexpr int MOTIONPIXELTHRESHOLD = 25;     // grey levels a pixel has to differ from the background to count as changed
+constexpr double MOTIONOPENFRACTION = 0.004; // part of the pixels that has to change to open the gate
+constexpr double MOTIONKEEPFRACTION = 0.002; // part of the pixels that has to change to keep it open
+constexpr double MOTIONLEARNINGRATE = 0.05;  // how fast the background follows slow changes like the light
+constexpr int MOTIONHOLDFRAMES = 90;         // still frames before the gate closes
+
+class MotionGate
+{
+public:
+    // Forget the background, the gate is open until it has seen enough still frames again
+    void reset()
+    {
+        background.release();
+        stillFrames = 0;
+        open = true;
+    }
+
+    // Compare frame with the background, returns true while something is (or recently was) moving
+    bool update(const cv::Mat &frame)
+    {
+        int height = std::max(1, frame.rows * MOTIONWIDTH / std::max(1, frame.cols));
+        cv::resize(frame, small, cv::Size(MOTIONWIDTH, height), 0, 0, cv::INTER_AREA);
+        if (small.channels() == 3)
+        {
+            cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+        }
+        else
+        {
+            small.copyTo(gray);
+        }
+
+        if (background.empty())
+        {
+            gray.convertTo(background, CV_32F);
+            stillFrames = 0;
+            open = true;
+            return open;
+        }
+
+        background.convertTo(background8u, CV_8U);
+        cv::absdiff(gray, background8u, difference);
+        cv::threshold(difference, difference, MOTIONPIXELTHRESHOLD, 255, cv::THRESH_BINARY);
+        double changed = (double)cv::countNonZero(difference) / difference.total();
+        cv::accumulateWeighted(gray, background, MOTIONLEARNINGRATE);
+
+        if (changed > (open ? MOTIONKEEPFRACTION : MOTIONOPENFRACTION))
+        {
+            stillFrames = 0;
+            open = true;
+        }
+        else if (open && ++stillFrames >= MOTIONHOLDFRAMES)
+        {
+            open = false;
+        }
+        return open;
+    }
+
+private:
+    // Reused between frames, all of them are tiny
+    cv::Mat small;
+    cv::Mat gray;
+    cv::Mat background; // running average, CV_32F
+    cv::Mat background8u;
+    cv::Mat difference;
+    int stillFrames = 0;
+    bool open = true;
+};
+
+#endif
@@ -0,0 +1,737 @@
+// MQTT side of the escape room: talks to the game server and hands what it hears to the detector through a GameChannel
+//
+// Runs as its own program (mqtt.cpp) next to herken, BridgeSharedShim then connects the channel to the shared memory
+// segment herken maps too, or the file shim fills it from the files herken writes and writes gameStart.txt for it.
+// In faceinator.cpp it shares the channel with the detector in the same process.
+
+#ifndef MQTTBRIDGE_HPP
+#define MQTTBRIDGE_HPP
+
+#include <iostream>
+#include <mosquitto.h>
+#include <fstream>
+#include <cstring>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include "nlohmann/json.hpp"
+#include "filewatcher.hpp"
+#include "filehandler.hpp"
+#include "gamechannel.hpp"
+#include "mqttmessage.hpp"
+#include "addresswatcher.hpp"
+#include "sharedsegment.hpp"
+
+using json = nlohmann::json;
+
+// Constants
+constexpr int IDLE = 0;
+constexpr int PROCESSING = 1;
+constexpr int DONE = 2;
+
+const char *broker_address = "10.0.0.10";
+const int broker_port = 1883;
+const char *topic = "alch/faceinator";
+const char *serverTopic = "alch";
+char _cfg_name[] = "faceinator";
+
+// How much the bridge prints: Debug also prints every message that comes in from the broker
+enum class LogLevel
+{
+    Error,
+    Info,
+    Debug
+};
+LogLevel bridgeLogLevel = LogLevel::Info;
+
+class MosquittoClient
+{
+public:
+    static MosquittoClient *instance;
+    struct mosquitto *mosq;
+    GameChannel &channel;
+    bool fileShim; // also write gameStart.txt for a herken running as its own program
+    bool PlayersHasBeenAsked = false;
+    bool ScanningHasBeenInformed = false;
+    bool ReadyHasBeenInformed = false;
+    bool connected = false;
+
+    // Reused for every incoming message, so handling one does not allocate
+    MqttMessageParser parser;
+    MqttMessage incoming;
+
+    // The info messages only change with the IP address, they are serialized again when it does
+    std::string ipAddress;
+    std::string startupInfoMessage;
+    std::string requestInfoMessage;
+
+    MosquittoClient(GameChannel &channel, bool fileShim) : channel(channel), fileShim(fileShim)
+    {
+        refreshAddress();
+        mosq = mosquitto_new(nullptr, true, nullptr);
+        if (!mosq)
+        {
+            std::cerr << "Error: Unable to create Mosquitto instance." << std::endl;
+            exit(1);
+        }
+
+        mosquitto_message_callback_set(mosq, message_callback);
+        connect();
+        connected = true;
+        subscribe(topic);
+    }
+
+    ~MosquittoClient()
+    {
+        sendDisconnectionMessage(); // Send disconnection message
+        mosquitto_destroy(mosq);
+        mosquitto_lib_cleanup();
+    }
+
+    void connect()
+    {
+        if (mosquitto_connect(mosq, broker_address, broker_port, 60) != MOSQ_ERR_SUCCESS)
+        {
+            std::cerr << "Error: Unable to connect to the broker." << std::endl;
+            exit(1);
+        }
+    }
+
+    void subscribe(const char *topic)
+    {
+        if (mosquitto_subscribe(mosq, nullptr, topic, 1) != MOSQ_ERR_SUCCESS)
+        {
+            std::cerr << "Error: Unable to subscribe to the topic." << std::endl;
+            exit(1);
+        }
+    }
+
+    // Descriptor of the broker connection for the event loop, -1 while it is lost
+    int socket()
+    {
+        return connected ? mosquitto_socket(mosq) : -1;
+    }
+
+    // Whether mosquitto has queued packets it could not send right away
+    bool wantsWrite()
+    {
+        return connected && mosquitto_want_write(mosq);
+    }
+
+    // Let mosquitto read and write what it can, incoming messages end up in message_callback.
+    // Returns false when the connection is lost, tick() then reconnects
+    bool handleSocket(uint32_t events)
+    {
+        int result = MOSQ_ERR_SUCCESS;
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            result = mosquitto_loop_read(mosq, 1);
+        if (result == MOSQ_ERR_SUCCESS && (events & EPOLLOUT))
+            result = mosquitto_loop_write(mosq, 1);
+        if (result != MOSQ_ERR_SUCCESS)
+        {
+            std::cerr << "Lost the connection to the broker: " << mosquitto_strerror(result) << std::endl;
+            connected = false;
+        }
+        return connected;
+    }
+
+    // Keepalive pings and retries of unacknowledged messages, call about once a second
+    void tick()
+    {
+        if (!connected)
+        {
+            if (mosquitto_reconnect(mosq) != MOSQ_ERR_SUCCESS)
+                return;
+            if (bridgeLogLevel >= LogLevel::Info)
+                std::cout << "Reconnected to the broker." << std::endl;
+            connected = true;
+            subscribe(topic);
+        }
+        mosquitto_loop_misc(mosq);
+    }
+
+    static void publish(const char *topic, const std::string &message)
+    {
+        if (instance && instance->mosq)
+        {
+            mosquitto_publish(instance->mosq, nullptr, topic, message.length(), message.c_str(), 1, false);
+        }
+        else
+        {
+            std::cerr << "Mosquitto instance is not initialized." << std::endl;
+        }
+    }
+
+    static std::string makeMessage(std::string sender, std::string method, int id, int value)
+    {
+        json message = {
+            {"sender", sender},
+            {"method", method},
+            {"outputs", json::array({{{"id", id}, {"value", value}}})}};
+        return message.dump();
+    }
+
+    // The message telling the server the state is IDLE, PROCESSING or DONE, serialized once
+    static const std::string &stateMessage(int state)
+    {
+        static const std::string messages[] = {
+            makeMessage(_cfg_name, "info", 1, IDLE),
+            makeMessage(_cfg_name, "info", 1, PROCESSING),
+            makeMessage(_cfg_name, "info", 1, DONE)};
+        return messages[state];
+    }
+
+    static std::string makeInfoMessage(const std::string &ip, const char *trigger)
+    {
+        json message = {
+            {"sender", _cfg_name},
+            {"connected", true},
+            {"ip", ip},
+            {"version", "v0.1.0"},
+            {"method", "info"},
+            {"trigger", trigger}};
+        return message.dump();
+    }
+
+    // Look the IP address up again, called at startup and whenever the addresses of the Pi change
+    void refreshAddress()
+    {
+        std::string ip = getIPAddress();
+        if (ip == ipAddress)
+            return;
+        ipAddress = ip;
+        startupInfoMessage = makeInfoMessage(ipAddress, "startup");
+        requestInfoMessage = makeInfoMessage(ipAddress, "request");
+        if (bridgeLogLevel >= LogLevel::Info)
+            std::cout << "IP address is " << ipAddress << std::endl;
+    }
+
+    static std::string getIPAddress()
+    {
+        struct ifaddrs *ifaddr, *ifa;
+        char ip[NI_MAXHOST];
+
+        if (getifaddrs(&ifaddr) == -1)
+        {
+            perror("getifaddrs");
+            exit(EXIT_FAILURE);
+        }
+
+        std::string ipAddress = "127.0.0.1"; // Default to localhost
+
+        for (ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next)
+        {
+            if (ifa->ifa_addr == nullptr)
+                continue;
+
+            int family = ifa->ifa_addr->sa_family;
+            if (family == AF_INET)
+            {
+                int s = getnameinfo(ifa->ifa_addr, sizeof(struct sockaddr_in), ip, NI_MAXHOST, nullptr, 0, NI_NUMERICHOST);
+                if (s != 0)
+                {
+                    std::cerr << "getnameinfo() failed: " << gai_strerror(s) << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                if (strcmp(ifa->ifa_name, "lo") != 0) // Skip loopback interface
+                {
+                    ipAddress = ip;
+                    break;
+                }
+            }
+        }
+
+        freeifaddrs(ifaddr);
+        return ipAddress;
+    }
+
+    void sendInfoMessage()
+    {
+        publish(serverTopic, startupInfoMessage);
+    }
+
+    void sendDisconnectionMessage()
+    {
+        json message = {
+            {"sender", _cfg_name},
+            {"connected", false},
+            {"method", "info"}};
+        publish(serverTopic, message.dump());
+    }
+
+    static void message_callback(struct mosquitto * /*mosq*/, void * /*userdata*/, const struct mosquitto_message *message)
+    {
+        if (message->payloadlen)
+        {
+            const char *payload = static_cast<const char *>(message->payload);
+            if (bridgeLogLevel >= LogLevel::Debug)
+            {
+                std::cout << "Received message on topic: " << message->topic << std::endl;
+                std::cout << "Message payload: ";
+                std::cout.write(payload, message->payloadlen) << std::endl;
+            }
+
+            if (instance)
+            {
+                if (instance->parser.parse(payload, message->payloadlen, instance->incoming))
+                    instance->handleMessage(instance->incoming);
+                else
+                    std::cerr << "Error parsing JSON: " << instance->parser.error() << std::endl;
+            }
+        }
+        else if (bridgeLogLevel >= LogLevel::Debug)
+        {
+            std::cout << "Message with empty payload received on topic: " << message->topic << std::endl;
+        }
+    }
+
+    void handleMessage(const MqttMessage &data)
+    {
+        try
+        {
+            if (data.hasSender && data.sender == _cfg_name)
+            {
+                if (bridgeLogLevel >= LogLevel::Debug)
+                    std::cout << "Message from self, ignoring." << std::endl;
+                return;
+            }
+            if (data.outputsArray)
+            {
+                for (int i = 0; i < data.outputCount; ++i)
+                {
+                    const MqttMessage::Output &output = data.outputs[i];
+                    if (output.hasId && output.hasValue)
+                    {
+                        int id = output.id;
+                        int value = output.value;
+                        if (id == 1 && value == 1)
+                        {
+                            if (bridgeLogLevel >= LogLevel::Info)
+                                std::cout << "Game start command received." << std::endl;
+                            // Before the start, a herken reading the files must not see the old done next to it
+                            FileHandler::writeToFile("0", DONEKEY);
+                            if (fileShim)
+                                FileHandler::writeToFile("1", STARTKEY);
+                            publish(serverTopic, stateMessage(PROCESSING));
+                            // A done of the previous round must not end this one right away
+                            channel.game.update([](GameStateSnapshot &state)
+                                                {
+                                state.gameStart = 1;
+                                state.done = 0; });
+                        }
+                    }
+                }
+            }
+            else if (data.hasPlayers)
+            {
+                int players = data.numberPlayers;
+                if (bridgeLogLevel >= LogLevel::Info)
+                    std::cout << "Value for key numPlayers: " << players << std::endl;
+                // The generator reads it from the file, also when the detector gets it through the channel
+                FileHandler::writeToFile(std::to_string(players), PLAYERSKEY);
+                channel.game.update([players](GameStateSnapshot &state)
+                                    { state.numberPlayers = players; });
+            }
+            else if (data.hasMethod && data.method == "get" && data.hasInfo && data.info == "system")
+            {
+                publish(serverTopic, requestInfoMessage);
+            }
+            else if (data.hasMethod && data.method == "put" && data.outputsReset)
+            {
+                if (bridgeLogLevel >= LogLevel::Info)
+                    std::cout << "Reset command received." << std::endl;
+                resetStates();
+                FileHandler::writeToFile("0", DONEKEY);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Error handling message: " << e.what() << std::endl;
+        }
+    }
+
+    bool gameStarted()
+    {
+        return channel.game.load().gameStart == 1;
+    }
+
+    void resetInternalValues()
+    {
+        channel.game.store(GameStateSnapshot());
+        PlayersHasBeenAsked = false;
+        ScanningHasBeenInformed = false;
+    }
+
+    // done.txt is left alone, a herken running as its own program may not have read the 1 yet. The next game start clears it
+    void resetStates()
+    {
+        resetInternalValues();
+        FileHandler::writeToFile("0", SCANNINGKEY);
+        FileHandler::writeToFile("0", PLAYERSKEY);
+        if (fileShim)
+            FileHandler::writeToFile("0", STARTKEY);
+    }
+
+    // The first call creates the client, later calls return that one whatever they pass
+    static MosquittoClient *getInstance(GameChannel &channel, bool fileShim)
+    {
+        if (!instance)
+        {
+            instance = new MosquittoClient(channel, fileShim);
+        }
+        return instance;
+    }
+};
+
+MosquittoClient *MosquittoClient::instance = nullptr;
+
+class GameLogic
+{
+public:
+    MosquittoClient *mosqClient;
+    GameChannel &channel;
+
+    time_t lastLatencyReport = 0;
+    bool doneHandled = false; // done.txt stays 1 until the next game start, the round is only ended once
+
+    GameLogic(MosquittoClient *client) : mosqClient(client), channel(client->channel) {}
+
+    // Sleeps in epoll until the broker sends something, the detector posts on the channel, one of the files is written,
+    // an IP address changes or the keepalive timer fires
+    void logic()
+    {
+        FileWatcher watcher;
+        // The generator is a separate program, its done.txt is always read from the file
+        watcher.onChange(std::string(DONEKEY) + ".txt", [this]
+                         { checkDone(); });
+        if (mosqClient->fileShim)
+        {
+            watcher.onChange(std::string(READYKEY) + ".txt", [this]
+                             { readReady(); });
+            watcher.onChange(std::string(LATENCYKEY) + ".txt", [this]
+                             { readLatency(); });
+            watcher.onChange(std::string(SCANNINGKEY) + ".txt", [this]
+                             { readScan(); });
+        }
+
+        int epollFd = epoll_create1(EPOLL_CLOEXEC);
+        int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct itimerspec everySecond = {{1, 0}, {1, 0}};
+        timerfd_settime(timerFd, 0, &everySecond, nullptr);
+        watch(epollFd, EPOLL_CTL_ADD, timerFd, EPOLLIN);
+        watch(epollFd, EPOLL_CTL_ADD, channel.fd(), EPOLLIN);
+        if (watcher.fd() >= 0)
+            watch(epollFd, EPOLL_CTL_ADD, watcher.fd(), EPOLLIN);
+        AddressWatcher addresses;
+        if (addresses.fd() >= 0)
+            watch(epollFd, EPOLL_CTL_ADD, addresses.fd(), EPOLLIN);
+
+        // The files may have been written while the bridge was not running
+        if (mosqClient->fileShim)
+        {
+            readReady();
+            readLatency();
+            readScan();
+        }
+        checkDone();
+
+        int brokerFd = -1;
+        uint32_t brokerEvents = 0;
+        struct epoll_event events[8];
+        while (true)
+        {
+            watchBroker(epollFd, brokerFd, brokerEvents);
+
+            int count = epoll_wait(epollFd, events, 8, -1);
+            for (int i = 0; i < count; ++i)
+            {
+                int fd = events[i].data.fd;
+                if (fd == timerFd)
+                {
+                    uint64_t expirations;
+                    ssize_t ignored = read(timerFd, &expirations, sizeof(expirations));
+                    (void)ignored;
+                    mosqClient->tick();
+                    // Without inotify the watcher can only re-read everything, once a second is plenty
+                    if (watcher.fd() < 0)
+                        watcher.dispatch();
+                }
+                else if (fd == channel.fd())
+                {
+                    handleDetectorEvents(channel.take());
+                }
+                else if (fd == watcher.fd())
+                {
+                    watcher.dispatch();
+                }
+                else if (fd == addresses.fd())
+                {
+                    if (addresses.dispatch())
+                        mosqClient->refreshAddress();
+                }
+                else if (fd == brokerFd)
+                {
+                    // Take a lost socket out right away, the reconnect may hand out a new one with the same number
+                    if (!mosqClient->handleSocket(events[i].events))
+                        watchBroker(epollFd, brokerFd, brokerEvents);
+                }
+            }
+
+            // Messages from the broker are handled in the reads above
+            checkGameStart();
+        }
+    }
+
+    // Only ask players if the game has started and we haven't asked for players yet
+    void checkGameStart()
+    {
+        if (mosqClient->gameStarted() && !mosqClient->PlayersHasBeenAsked)
+        {
+            askPlayers();
+            if (bridgeLogLevel >= LogLevel::Info)
+                std::cout << "Players have been asked" << std::endl;
+            mosqClient->PlayersHasBeenAsked = true;
+        }
+    }
+
+    static void watch(int epollFd, int operation, int fd, uint32_t events)
+    {
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, operation, fd, &event) < 0 && operation != EPOLL_CTL_DEL)
+        {
+            perror("epoll_ctl");
+        }
+    }
+
+    // Keep the broker socket in the epoll set, it changes on a reconnect and only waits for writability while mosquitto has something queued
+    void watchBroker(int epollFd, int &brokerFd, uint32_t &brokerEvents)
+    {
+        int fd = mosqClient->socket();
+        uint32_t wanted = EPOLLIN | (mosqClient->wantsWrite() ? (uint32_t)EPOLLOUT : 0u);
+        if (fd != brokerFd)
+        {
+            if (brokerFd >= 0)
+                watch(epollFd, EPOLL_CTL_DEL, brokerFd, 0);
+            if (fd >= 0)
+                watch(epollFd, EPOLL_CTL_ADD, fd, wanted);
+        }
+        else if (fd >= 0 && wanted != brokerEvents)
+        {
+            watch(epollFd, EPOLL_CTL_MOD, fd, wanted);
+        }
+        brokerFd = fd;
+        brokerEvents = wanted;
+    }
+
+    void askPlayers()
+    {
+        static const std::string messageStr = json{
+            {"sender", _cfg_name},
+            {"numPlayers", nullptr}, // Using nullptr to denote null in JSON
+            {"method", "get"}}.dump(); // Serialized once, it never changes
+        MosquittoClient::publish("alch/game", messageStr);
+    }
+
+    void handleDetectorEvents(uint32_t events)
+    {
+        if (events & DETECTORREADY)
+            informReady();
+        if (events & SCANNINGCOMPLETE)
+            informScan();
+        if (events & LATENCYREPORT)
+            informLatency(channel.takeLatencyReport());
+    }
+
+    // The detector is ready once its network is loaded and warmed up, until then the first group would have to wait
+    void informReady()
+    {
+        if (channel.detectorReady() && !mosqClient->ReadyHasBeenInformed)
+        {
+            if (bridgeLogLevel >= LogLevel::Info)
+                std::cout << "Detector is ready" << std::endl;
+            static const std::string message = json{
+                {"sender", _cfg_name},
+                {"method", "info"},
+                {"detectorReady", true}}.dump();
+            MosquittoClient::publish(serverTopic, message);
+            mosqClient->ReadyHasBeenInformed = true;
+        }
+        else if (!channel.detectorReady())
+        {
+            // herken restarted, tell the server again once it is back
+            mosqClient->ReadyHasBeenInformed = false;
+        }
+    }
+
+    // The per stage latency percentiles the detector reports every so often, forwarded to the server
+    void informLatency(const std::string &report)
+    {
+        json latency = json::parse(report, nullptr, false);
+        if (latency.is_discarded())
+        {
+            std::cerr << "The latency report is not valid JSON" << std::endl;
+            return;
+        }
+        json message = {
+            {"sender", _cfg_name},
+            {"method", "info"},
+            {"latency", latency}};
+        MosquittoClient::publish(serverTopic, message.dump());
+    }
+
+    void informScan()
+    {
+        if (mosqClient->ScanningHasBeenInformed)
+            return;
+        if (bridgeLogLevel >= LogLevel::Info)
+            std::cout << "Scanning complete" << std::endl;
+        // With the shim herken wrote the file itself, otherwise the generator still waits for it
+        if (!mosqClient->fileShim)
+            FileHandler::writeToFile("1", SCANNINGKEY);
+        MosquittoClient::publish(serverTopic, MosquittoClient::stateMessage(DONE));
+        mosqClient->ScanningHasBeenInformed = true;
+    }
+
+    // File shim, what a herken running as its own program writes is posted on the channel as if it came from the detector
+    void readReady()
+    {
+        channel.setDetectorReady(FileHandler::readFromFile(READYKEY) == "1");
+    }
+
+    void readLatency()
+    {
+        // Without inotify this is called every second, the report only changes every so many
+        struct stat info;
+        if (stat((std::string(LATENCYKEY) + ".txt").c_str(), &info) != 0 || info.st_mtime == lastLatencyReport)
+            return;
+        lastLatencyReport = info.st_mtime;
+        channel.postLatencyReport(FileHandler::readFromFile(LATENCYKEY));
+    }
+
+    void readScan()
+    {
+        if (FileHandler::readFromFile(SCANNINGKEY) == "1")
+            channel.post(SCANNINGCOMPLETE);
+    }
+
+    void checkDone()
+    {
+        std::string value = FileHandler::readFromFile(DONEKEY);
+        if (value != "1")
+        {
+            doneHandled = false;
+        }
+        else if (!doneHandled)
+        {
+            doneHandled = true;
+            if (bridgeLogLevel >= LogLevel::Info)
+                std::cout << "done.txt = 1" << std::endl;
+            MosquittoClient::publish(serverTopic, MosquittoClient::stateMessage(IDLE));
+            resetStates();
+            // Reset and done in one go, the detector wakes up to done and resets itself. The next game start clears it
+            channel.game.update([](GameStateSnapshot &state)
+                                { state.done = 1; });
+        }
+    }
+
+    void resetStates()
+    {
+        mosqClient->resetStates();
+    }
+};
+
+// Connects the channel to a herken running as its own program through the shared memory segment. What the bridge puts
+// in channel.game is copied to the segment, what the detector writes in the segment is posted on the channel as if it
+// ran in this process. Use the bridge without fileShim next to it, the generator files are then written by the bridge
+class BridgeSharedShim
+{
+public:
+    BridgeSharedShim(GameChannel &channel, SharedSegment &segment)
+        : channel(channel), segment(segment), watcher(segment, [this](const SharedGame &game)
+                                                      { postDetectorEvents(game); })
+    {
+        mirror = std::thread(&BridgeSharedShim::mirrorGameState, this);
+    }
+
+    ~BridgeSharedShim()
+    {
+        stopping = true;
+        channel.game.close();
+        mirror.join();
+    }
+
+    BridgeSharedShim(const BridgeSharedShim &) = delete;
+    BridgeSharedShim &operator=(const BridgeSharedShim &) = delete;
+
+private:
+    GameChannel &channel;
+    SharedSegment &segment;
+    std::thread mirror;
+    std::atomic<bool> stopping{false};
+    SharedGame seen;
+    bool seenOnce = false;
+    SharedSegmentWatcher watcher; // last, so its thread is gone before the members it uses
+
+    // Copy the game state to the segment every time the bridge changes it. A game start begins a new round
+    void mirrorGameState()
+    {
+        GameStateSnapshot copied = channel.game.load();
+        store(copied, GameStateSnapshot());
+        while (!stopping)
+        {
+            GameStateSnapshot state = channel.game.waitUntil([&copied](const GameStateSnapshot &snapshot)
+                                                             { return snapshot.numberPlayers != copied.numberPlayers || snapshot.gameStart != copied.gameStart || snapshot.done != copied.done; });
+            if (stopping)
+                return;
+            store(state, copied);
+            copied = state;
+        }
+    }
+
+    void store(const GameStateSnapshot &state, const GameStateSnapshot &previous)
+    {
+        segment.update([&state, &previous](SharedGame &game)
+                       {
+            if (state.gameStart && !previous.gameStart)
+            {
+                game.roundId++;
+                game.scanningComplete = 0;
+            }
+            game.numberPlayers = state.numberPlayers;
+            game.gameStart = state.gameStart;
+            game.done = state.done; });
+    }
+
+    // Post what the detector wrote in the segment, on the watcher thread. Only changes are posted, except for the
+    // detector being ready which the bridge has to know from the start
+    void postDetectorEvents(const SharedGame &game)
+    {
+        if (!seenOnce)
+        {
+            channel.setDetectorReady(game.detectorReady != 0);
+        }
+        else
+        {
+            if (game.detectorReady != seen.detectorReady)
+                channel.setDetectorReady(game.detectorReady != 0);
+            if (game.scanningComplete && !seen.scanningComplete)
+                channel.post(SCANNINGCOMPLETE);
+            if (game.latencySequence != seen.latencySequence)
+                channel.postLatencyReport(segment.readLatencyReport());
+        }
+        seen = game;
+        seenOnce = true;
+    }
+};
+
+#endif
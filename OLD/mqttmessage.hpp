@@ -0,0 +1,270 @@
+// Reads the few keys the bridge acts on straight out of an MQTT payload
+//
+// The payload is walked with the SAX interface of nlohmann::json, so no json tree is built and the payload is not copied
+// first. Only sender, method, info, numPlayers and outputs are kept, in a MqttMessage that is reused for every message:
+// its strings keep their capacity, so after the first few messages handling one does not allocate anymore.
+// Everything else in the payload, nested or not, is skipped.
+
+#ifndef MQTTMESSAGE_HPP
+#define MQTTMESSAGE_HPP
+
+#include "nlohmann/json.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+struct MqttMessage
+{
+    static constexpr int MAXOUTPUTS = 8; // the server sends one, more are ignored
+
+    struct Output
+    {
+        bool hasId;
+        bool hasValue;
+        int id;
+        int value;
+    };
+
+    bool hasSender;
+    bool hasMethod;
+    bool hasInfo;
+    bool hasPlayers;   // numPlayers was there and a number, or a string holding one
+    bool outputsArray; // outputs was a list of {id, value}
+    bool outputsReset; // outputs was the string "reset"
+    std::string sender;
+    std::string method;
+    std::string info;
+    int numberPlayers;
+    int outputCount;
+    Output outputs[MAXOUTPUTS];
+
+    void clear()
+    {
+        hasSender = hasMethod = hasInfo = hasPlayers = outputsArray = outputsReset = false;
+        sender.clear();
+        method.clear();
+        info.clear();
+        numberPlayers = 0;
+        outputCount = 0;
+    }
+};
+
+class MqttMessageParser : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+    // Fill message from the payload, false when it is not valid JSON, error() then tells why
+    bool parse(const char *payload, size_t length, MqttMessage &message)
+    {
+        target = &message;
+        target->clear();
+        depth = 0;
+        topKey = Key::Other;
+        outputKey = Key::Other;
+        inOutputs = false;
+        failed = false;
+        return nlohmann::json::sax_parse(payload, payload + length, this) && !failed;
+    }
+
+    const std::string &error() const
+    {
+        return errorText;
+    }
+
+    bool null() override
+    {
+        return true;
+    }
+
+    bool boolean(bool) override
+    {
+        return true;
+    }
+
+    bool number_integer(number_integer_t value) override
+    {
+        integer((long long)value);
+        return true;
+    }
+
+    bool number_unsigned(number_unsigned_t value) override
+    {
+        integer((long long)value);
+        return true;
+    }
+
+    bool number_float(number_float_t, const string_t &) override
+    {
+        return true;
+    }
+
+    bool string(string_t &value) override
+    {
+        if (depth != 1)
+            return true;
+        switch (topKey)
+        {
+        case Key::Sender:
+            target->sender.assign(value);
+            target->hasSender = true;
+            break;
+        case Key::Method:
+            target->method.assign(value);
+            target->hasMethod = true;
+            break;
+        case Key::Info:
+            target->info.assign(value);
+            target->hasInfo = true;
+            break;
+        case Key::NumPlayers:
+        {
+            // The server sends it as a string
+            char *end;
+            long players = std::strtol(value.c_str(), &end, 10);
+            if (!value.empty() && *end == '\0')
+            {
+                target->numberPlayers = (int)players;
+                target->hasPlayers = true;
+            }
+            else
+            {
+                std::cerr << "Invalid numPlayers: " << value << std::endl;
+            }
+            break;
+        }
+        case Key::Outputs:
+            target->outputsReset = value == "reset";
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    bool binary(binary_t &) override
+    {
+        return true;
+    }
+
+    bool start_object(std::size_t) override
+    {
+        depth++;
+        // An {id, value} in the outputs list
+        if (inOutputs && depth == 3)
+        {
+            outputKey = Key::Other;
+            if (target->outputCount < MqttMessage::MAXOUTPUTS)
+                target->outputs[target->outputCount] = MqttMessage::Output{false, false, 0, 0};
+        }
+        return true;
+    }
+
+    bool key(string_t &name) override
+    {
+        if (depth == 1)
+        {
+            if (name == "sender")
+                topKey = Key::Sender;
+            else if (name == "method")
+                topKey = Key::Method;
+            else if (name == "info")
+                topKey = Key::Info;
+            else if (name == "numPlayers")
+                topKey = Key::NumPlayers;
+            else if (name == "outputs")
+                topKey = Key::Outputs;
+            else
+                topKey = Key::Other;
+        }
+        else if (inOutputs && depth == 3)
+        {
+            if (name == "id")
+                outputKey = Key::Id;
+            else if (name == "value")
+                outputKey = Key::Value;
+            else
+                outputKey = Key::Other;
+        }
+        return true;
+    }
+
+    bool end_object() override
+    {
+        if (inOutputs && depth == 3 && target->outputCount < MqttMessage::MAXOUTPUTS)
+            target->outputCount++;
+        depth--;
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        depth++;
+        if (depth == 2 && topKey == Key::Outputs)
+        {
+            inOutputs = true;
+            target->outputsArray = true;
+        }
+        return true;
+    }
+
+    bool end_array() override
+    {
+        if (depth == 2)
+            inOutputs = false;
+        depth--;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &exception) override
+    {
+        errorText = exception.what();
+        failed = true;
+        return false;
+    }
+
+private:
+    enum class Key
+    {
+        Sender,
+        Method,
+        Info,
+        NumPlayers,
+        Outputs,
+        Id,
+        Value,
+        Other
+    };
+
+    MqttMessage *target = nullptr;
+    int depth = 0;
+    Key topKey = Key::Other;
+    Key outputKey = Key::Other;
+    bool inOutputs = false;
+    bool failed = false;
+    std::string errorText;
+
+    void integer(long long value)
+    {
+        if (depth == 1 && topKey == Key::NumPlayers)
+        {
+            target->numberPlayers = (int)value;
+            target->hasPlayers = true;
+        }
+        else if (inOutputs && depth == 3 && target->outputCount < MqttMessage::MAXOUTPUTS)
+        {
+            MqttMessage::Output &output = target->outputs[target->outputCount];
+            if (outputKey == Key::Id)
+            {
+                output.id = (int)value;
+                output.hasId = true;
+            }
+            else if (outputKey == Key::Value)
+            {
+                output.value = (int)value;
+                output.hasValue = true;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,96 @@
+// Plays back a recording as if it came from the webcam, for benchmarking without a camera in front of people
+//
+// The source is anything VideoCapture opens (a video file, img_%04d.jpg) or a directory of .jpg/.png frames, played in
+// name order. All frames are decoded up front so reading from disk never shows up in the timings, read() then only
+// copies the next frame out. With an fps the frames come at that rate like a webcam would deliver them, 0 hands them
+// out as fast as they are read.
+
+#ifndef REPLAYCAPTURE_HPP
+#define REPLAYCAPTURE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ReplayCapture
+{
+public:
+    // Keeps at most maxFrames frames in memory, a 1280x640 frame takes 2.4 MB
+    ReplayCapture(const std::string &path, int fps, size_t maxFrames = 1000)
+        : interval(fps > 0 ? std::chrono::nanoseconds(1000000000 / fps) : std::chrono::nanoseconds(0))
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+        {
+            std::vector<cv::String> files;
+            cv::glob(path + "/*.jpg", files, false);
+            std::vector<cv::String> pngs;
+            cv::glob(path + "/*.png", pngs, false);
+            files.insert(files.end(), pngs.begin(), pngs.end());
+            std::sort(files.begin(), files.end());
+            for (const auto &file : files)
+            {
+                if (frames.size() >= maxFrames)
+                    break;
+                cv::Mat frame = cv::imread(file);
+                if (!frame.empty())
+                    frames.push_back(frame);
+            }
+        }
+        else
+        {
+            cv::VideoCapture input(path);
+            cv::Mat frame;
+            while (frames.size() < maxFrames && input.read(frame) && !frame.empty())
+            {
+                frames.push_back(frame.clone());
+            }
+        }
+
+        if (frames.empty())
+        {
+            std::cerr << "No frames in " << path << std::endl;
+            return;
+        }
+        std::cout << "Replaying " << frames.size() << " frames of " << frames[0].cols << "x" << frames[0].rows << " from " << path << std::endl;
+    }
+
+    bool isOpened() const
+    {
+        return !frames.empty();
+    }
+
+    size_t frameCount() const
+    {
+        return frames.size();
+    }
+
+    // Copy the next frame into frame, after the first one this reuses its memory. Returns false once all frames were read
+    bool read(cv::Mat &frame)
+    {
+        if (next >= frames.size())
+            return false;
+
+        if (interval.count() > 0)
+        {
+            if (next == 0)
+                start = std::chrono::steady_clock::now();
+            std::this_thread::sleep_until(start + interval * next);
+        }
+        frames[next++].copyTo(frame);
+        return true;
+    }
+
+private:
+    std::vector<cv::Mat> frames;
+    size_t next = 0;
+    std::chrono::nanoseconds interval;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,362 @@
+// Game state in POSIX shared memory, for running herken and mqtt as two programs without the text files
+//
+// Both programs map the same segment. The game state sits behind a seqlock: a writer makes the sequence odd, changes the
+// values and makes it even again, a reader copies the values and tries again when the sequence was odd or changed in
+// the meantime. Reading is a handful of loads, no syscall and no lock, and never shows a half written or empty value.
+// Both sides write (the bridge the game, the detector its progress), a robust process shared mutex keeps the writers apart.
+// Who has to react to a change sleeps in a futex on the sequence, every write wakes them. SharedSegmentWatcher does that
+// on a thread of its own. A program killed halfway through a write leaves the sequence odd and the mutex owned by a dead
+// process, which the kernel tells the next one to lock it. That one puts back the state from before the write, a copy the
+// writer keeps for this, and makes the sequence even again. A writer that is only slow is waited for however long it takes.
+
+#ifndef SHAREDSEGMENT_HPP
+#define SHAREDSEGMENT_HPP
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+constexpr char SHAREDSEGMENTNAME[] = "/faceinator";
+constexpr uint32_t SHAREDSEGMENTVERSION = 3;           // bump when the layout below changes
+constexpr uint32_t SHAREDSEGMENTINITIALIZING = UINT32_MAX; // version while the first program to map it sets up the mutex
+constexpr size_t LATENCYREPORTBYTES = 2048;
+constexpr int SHAREDSPINS = 1000;        // times the sequence is checked before going to sleep on it, a write takes a few stores
+constexpr int SHAREDWRITERCHECKMS = 100; // how often a reader waiting for a write checks whether its writer still lives
+
+// One consistent copy of the game state
+struct SharedGame
+{
+    int32_t numberPlayers = 0;
+    int32_t gameStart = 0;
+    int32_t scanningComplete = 0;
+    int32_t done = 0;
+    int32_t detectorReady = 0;
+    uint32_t roundId = 0;         // goes up with every game start
+    uint32_t latencySequence = 0; // goes up with every latency report
+};
+
+class SharedSegment
+{
+public:
+    // Creates the segment when the other program has not yet, isOpened() is false when it can not be used
+    SharedSegment()
+    {
+        int fd = shm_open(SHAREDSEGMENTNAME, O_CREAT | O_RDWR | O_CLOEXEC, 0666);
+        if (fd < 0)
+        {
+            std::cerr << "Unable to open shared memory " << SHAREDSEGMENTNAME << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        // A new segment is all zeros, which is a valid empty state. Whoever comes second finds it at the right size already
+        struct stat info;
+        if (fstat(fd, &info) < 0 || ((size_t)info.st_size != sizeof(Layout) && ftruncate(fd, sizeof(Layout)) < 0))
+        {
+            std::cerr << "Unable to size shared memory " << SHAREDSEGMENTNAME << ": " << std::strerror(errno) << std::endl;
+            close(fd);
+            return;
+        }
+        void *mapping = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            std::cerr << "Unable to map shared memory " << SHAREDSEGMENTNAME << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        layout = static_cast<Layout *>(mapping);
+
+        uint32_t version = 0;
+        if (layout->version.compare_exchange_strong(version, SHAREDSEGMENTINITIALIZING))
+        {
+            pthread_mutexattr_t attributes;
+            pthread_mutexattr_init(&attributes);
+            pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+            pthread_mutex_init(&layout->writeLock, &attributes);
+            pthread_mutexattr_destroy(&attributes);
+            layout->version.store(SHAREDSEGMENTVERSION, std::memory_order_release);
+            version = SHAREDSEGMENTVERSION;
+        }
+        // The other program is setting it up right now
+        for (int i = 0; version == SHAREDSEGMENTINITIALIZING && i < 1000; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            version = layout->version.load(std::memory_order_acquire);
+        }
+        if (version != SHAREDSEGMENTVERSION)
+        {
+            std::cerr << SHAREDSEGMENTNAME << " has layout " << version << " instead of " << SHAREDSEGMENTVERSION
+                      << ", remove /dev/shm" << SHAREDSEGMENTNAME << " once both programs are updated." << std::endl;
+            munmap(layout, sizeof(Layout));
+            layout = nullptr;
+        }
+    }
+
+    ~SharedSegment()
+    {
+        if (layout)
+            munmap(layout, sizeof(Layout));
+    }
+
+    SharedSegment(const SharedSegment &) = delete;
+    SharedSegment &operator=(const SharedSegment &) = delete;
+
+    bool isOpened() const
+    {
+        return layout != nullptr;
+    }
+
+    // Current sequence, pass it to waitForChange() to sleep until the next write
+    uint32_t sequence() const
+    {
+        return layout->sequence.load(std::memory_order_acquire);
+    }
+
+    SharedGame load() const
+    {
+        while (true)
+        {
+            uint32_t before = layout->sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                waitWhileWriting(before);
+                continue;
+            }
+            SharedGame game = loadLocked();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before == layout->sequence.load(std::memory_order_relaxed))
+                return game;
+        }
+    }
+
+    // Change some of the values, change gets the current state to modify. Wakes everyone waiting for a change
+    template <typename Change>
+    void update(Change change)
+    {
+        uint32_t before = lockForWriting();
+        SharedGame game = loadLocked();
+        change(game);
+        storeLocked(game);
+        unlock(before);
+    }
+
+    void writeLatencyReport(const std::string &json)
+    {
+        uint32_t before = lockForWriting();
+        size_t length = std::min(json.size(), LATENCYREPORTBYTES);
+        std::memcpy(layout->latencyReport, json.data(), length);
+        layout->latencyLength.store((uint32_t)length, std::memory_order_relaxed);
+        layout->latencySequence.fetch_add(1, std::memory_order_relaxed);
+        unlock(before);
+    }
+
+    std::string readLatencyReport() const
+    {
+        std::string json;
+        while (true)
+        {
+            uint32_t before = layout->sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                waitWhileWriting(before);
+                continue;
+            }
+            size_t length = std::min<size_t>(layout->latencyLength.load(std::memory_order_relaxed), LATENCYREPORTBYTES);
+            json.assign(layout->latencyReport, length);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before == layout->sequence.load(std::memory_order_relaxed))
+                return json;
+        }
+    }
+
+    // Sleep until the sequence is no longer seen, or timeoutMillis passed (-1 waits forever). Returns right away when
+    // it already changed, may also return without a change
+    void waitForChange(uint32_t seen, int timeoutMillis = -1) const
+    {
+        if (layout->sequence.load(std::memory_order_acquire) != seen)
+            return;
+        struct timespec timeout = {timeoutMillis / 1000, (timeoutMillis % 1000) * 1000000L};
+        syscall(SYS_futex, &layout->sequence, FUTEX_WAIT, seen, timeoutMillis < 0 ? nullptr : &timeout, nullptr, 0);
+    }
+
+    // Wake everything in waitForChange() without changing anything, used when shutting down
+    void wakeAll() const
+    {
+        syscall(SYS_futex, &layout->sequence, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+private:
+    // Exactly what is in the shared memory, everything starts out as zero
+    struct Layout
+    {
+        std::atomic<uint32_t> version;
+        std::atomic<uint32_t> sequence; // odd while someone is writing, also the futex word
+        pthread_mutex_t writeLock;      // robust and process shared, held for the whole write
+        SharedGame backup;              // the state before the current write, only touched holding writeLock
+        std::atomic<int32_t> numberPlayers;
+        std::atomic<int32_t> gameStart;
+        std::atomic<int32_t> scanningComplete;
+        std::atomic<int32_t> done;
+        std::atomic<int32_t> detectorReady;
+        std::atomic<uint32_t> roundId;
+        std::atomic<uint32_t> latencySequence;
+        std::atomic<uint32_t> latencyLength;
+        char latencyReport[LATENCYREPORTBYTES];
+    };
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && ATOMIC_INT_LOCK_FREE == 2,
+                  "the futex and the other program need plain lock free 32 bit words");
+
+    Layout *layout = nullptr;
+
+    // Wait until the write that made the sequence odd is done. Spins first since that normally takes a few stores, then
+    // sleeps on the futex. Every SHAREDWRITERCHECKMS it checks whether the writer died in the middle of it
+    void waitWhileWriting(uint32_t odd) const
+    {
+        for (int i = 0; i < SHAREDSPINS; ++i)
+        {
+            if (layout->sequence.load(std::memory_order_acquire) != odd)
+                return;
+        }
+        while (layout->sequence.load(std::memory_order_acquire) == odd)
+        {
+            waitForChange(odd, SHAREDWRITERCHECKMS);
+            if (layout->sequence.load(std::memory_order_acquire) != odd)
+                return;
+            // Busy while the writer is alive, stopped or not. Only a dead owner hands it over
+            int result = pthread_mutex_trylock(&layout->writeLock);
+            if (result == EOWNERDEAD)
+                recoverLocked();
+            if (result == 0 || result == EOWNERDEAD)
+                pthread_mutex_unlock(&layout->writeLock);
+        }
+    }
+
+    uint32_t lockForWriting()
+    {
+        if (pthread_mutex_lock(&layout->writeLock) == EOWNERDEAD)
+            recoverLocked();
+        uint32_t before = layout->sequence.load(std::memory_order_relaxed);
+        // What recoverLocked() puts back when this write does not make it
+        layout->backup = loadLocked();
+        layout->sequence.store(before + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return before;
+    }
+
+    void unlock(uint32_t before)
+    {
+        layout->sequence.store(before + 2, std::memory_order_release);
+        pthread_mutex_unlock(&layout->writeLock);
+        // Both programs together write a handful of times per round, a wake with nobody asleep is a single cheap syscall
+        wakeAll();
+    }
+
+    // Holding writeLock after its previous owner died. When it died halfway through a write the values are put back as they
+    // were before it, only the latency report is lost since there is no copy of it
+    void recoverLocked() const
+    {
+        uint32_t odd = layout->sequence.load(std::memory_order_relaxed);
+        if (odd & 1)
+        {
+            const SharedGame &game = layout->backup;
+            layout->numberPlayers.store(game.numberPlayers, std::memory_order_relaxed);
+            layout->gameStart.store(game.gameStart, std::memory_order_relaxed);
+            layout->scanningComplete.store(game.scanningComplete, std::memory_order_relaxed);
+            layout->done.store(game.done, std::memory_order_relaxed);
+            layout->detectorReady.store(game.detectorReady, std::memory_order_relaxed);
+            layout->roundId.store(game.roundId, std::memory_order_relaxed);
+            layout->latencySequence.store(game.latencySequence, std::memory_order_relaxed);
+            layout->latencyLength.store(0, std::memory_order_relaxed);
+            layout->sequence.store(odd + 1, std::memory_order_release);
+            std::cerr << "A write to " << SHAREDSEGMENTNAME << " was cut off by its program dying, put back the state from before it." << std::endl;
+            wakeAll();
+        }
+        pthread_mutex_consistent(&layout->writeLock);
+    }
+
+    SharedGame loadLocked() const
+    {
+        SharedGame game;
+        game.numberPlayers = layout->numberPlayers.load(std::memory_order_relaxed);
+        game.gameStart = layout->gameStart.load(std::memory_order_relaxed);
+        game.scanningComplete = layout->scanningComplete.load(std::memory_order_relaxed);
+        game.done = layout->done.load(std::memory_order_relaxed);
+        game.detectorReady = layout->detectorReady.load(std::memory_order_relaxed);
+        game.roundId = layout->roundId.load(std::memory_order_relaxed);
+        game.latencySequence = layout->latencySequence.load(std::memory_order_relaxed);
+        return game;
+    }
+
+    void storeLocked(const SharedGame &game)
+    {
+        layout->numberPlayers.store(game.numberPlayers, std::memory_order_relaxed);
+        layout->gameStart.store(game.gameStart, std::memory_order_relaxed);
+        layout->scanningComplete.store(game.scanningComplete, std::memory_order_relaxed);
+        layout->done.store(game.done, std::memory_order_relaxed);
+        layout->detectorReady.store(game.detectorReady, std::memory_order_relaxed);
+        layout->roundId.store(game.roundId, std::memory_order_relaxed);
+        // latencySequence only changes through writeLatencyReport()
+    }
+};
+
+// Calls onChange on a thread of its own with the state of the segment, once right away and again after every write to
+// it (sometimes also without a change). Sleeps on the futex in between, until the watcher is destroyed
+class SharedSegmentWatcher
+{
+public:
+    SharedSegmentWatcher(SharedSegment &segment, std::function<void(const SharedGame &)> onChange)
+        : segment(segment), onChange(std::move(onChange)), thread(&SharedSegmentWatcher::run, this)
+    {
+    }
+
+    ~SharedSegmentWatcher()
+    {
+        stopping = true;
+        // The thread can check stopping right before this and go to sleep after the wake, so keep waking it until it is out
+        while (!stopped)
+        {
+            segment.wakeAll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        thread.join();
+    }
+
+    SharedSegmentWatcher(const SharedSegmentWatcher &) = delete;
+    SharedSegmentWatcher &operator=(const SharedSegmentWatcher &) = delete;
+
+private:
+    SharedSegment &segment;
+    std::function<void(const SharedGame &)> onChange;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> stopped{false};
+    std::thread thread;
+
+    void run()
+    {
+        while (!stopping)
+        {
+            uint32_t seen = segment.sequence();
+            onChange(segment.load());
+            segment.waitForChange(seen);
+        }
+        stopped = true;
+    }
+};
+
+#endif
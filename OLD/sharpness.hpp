@@ -0,0 +1,176 @@
+// Sharpness score (variance of the Laplacian) of face crops, shared by herken.cpp and benchsharpness.cpp
+//
+// Gives the same number as cv::Laplacian(gray, laplacian, CV_64F) followed by cv::meanStdDev, but the 3x3 Laplacian
+// is computed on the 8-bit pixels in 16-bit lanes and its sum and sum of squares are accumulated in the same pass,
+// so no full size double image is ever made.
+
+#ifndef SHARPNESS_HPP
+#define SHARPNESS_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Pixels handled between two flushes of the 32-bit accumulators, a squared Laplacian is at most 1020^2,
+// so this keeps every lane far away from overflowing whatever the image width
+constexpr int SHARPNESSCHUNK = 1024;
+
+// Laplacian of a single pixel, [0 1 0; 1 -4 1; 0 1 0]
+inline int laplacianAt(const uint8_t *up, const uint8_t *row, const uint8_t *down, int x, int left, int right)
+{
+    return up[x] + down[x] + row[left] + row[right] - 4 * row[x];
+}
+
+// Add the Laplacian of pixels [begin, end) of a row to sum and sumSquares, all of them need both horizontal neighbours inside the row
+inline void accumulateLaplacianRow(const uint8_t *up, const uint8_t *row, const uint8_t *down, int begin, int end,
+                                   int64_t &sum, int64_t &sumSquares)
+{
+    int x = begin;
+
+#if defined(__AVX2__)
+    for (; x + 16 <= end;)
+    {
+        __m256i sums = _mm256_setzero_si256();
+        __m256i squares = _mm256_setzero_si256();
+        const __m256i ones = _mm256_set1_epi16(1);
+        for (int chunkEnd = std::min(end, x + SHARPNESSCHUNK); x + 16 <= chunkEnd; x += 16)
+        {
+            __m256i center = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(row + x)));
+            __m256i left = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(row + x - 1)));
+            __m256i right = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(row + x + 1)));
+            __m256i above = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(up + x)));
+            __m256i below = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(down + x)));
+            __m256i laplacian = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(above, below), _mm256_add_epi16(left, right)),
+                                                 _mm256_slli_epi16(center, 2));
+            sums = _mm256_add_epi32(sums, _mm256_madd_epi16(laplacian, ones));
+            squares = _mm256_add_epi32(squares, _mm256_madd_epi16(laplacian, laplacian));
+        }
+        alignas(32) int32_t lanes[8];
+        _mm256_store_si256((__m256i *)lanes, sums);
+        for (int32_t lane : lanes)
+            sum += lane;
+        _mm256_store_si256((__m256i *)lanes, squares);
+        for (int32_t lane : lanes)
+            sumSquares += lane;
+    }
+#elif defined(__SSE2__)
+    for (; x + 8 <= end;)
+    {
+        __m128i sums = _mm_setzero_si128();
+        __m128i squares = _mm_setzero_si128();
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        for (int chunkEnd = std::min(end, x + SHARPNESSCHUNK); x + 8 <= chunkEnd; x += 8)
+        {
+            __m128i center = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x)), zero);
+            __m128i left = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x - 1)), zero);
+            __m128i right = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x + 1)), zero);
+            __m128i above = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(up + x)), zero);
+            __m128i below = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(down + x)), zero);
+            __m128i laplacian = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(above, below), _mm_add_epi16(left, right)),
+                                              _mm_slli_epi16(center, 2));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(laplacian, ones));
+            squares = _mm_add_epi32(squares, _mm_madd_epi16(laplacian, laplacian));
+        }
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128((__m128i *)lanes, sums);
+        for (int32_t lane : lanes)
+            sum += lane;
+        _mm_store_si128((__m128i *)lanes, squares);
+        for (int32_t lane : lanes)
+            sumSquares += lane;
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 8 <= end;)
+    {
+        int32x4_t sums = vdupq_n_s32(0);
+        int32x4_t squares = vdupq_n_s32(0);
+        for (int chunkEnd = std::min(end, x + SHARPNESSCHUNK); x + 8 <= chunkEnd; x += 8)
+        {
+            int16x8_t center = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x)));
+            int16x8_t left = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x - 1)));
+            int16x8_t right = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x + 1)));
+            int16x8_t above = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + x)));
+            int16x8_t below = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + x)));
+            int16x8_t laplacian = vsubq_s16(vaddq_s16(vaddq_s16(above, below), vaddq_s16(left, right)), vshlq_n_s16(center, 2));
+            sums = vpadalq_s16(sums, laplacian);
+            squares = vmlal_s16(squares, vget_low_s16(laplacian), vget_low_s16(laplacian));
+            squares = vmlal_s16(squares, vget_high_s16(laplacian), vget_high_s16(laplacian));
+        }
+        int32_t lanes[4];
+        vst1q_s32(lanes, sums);
+        for (int32_t lane : lanes)
+            sum += lane;
+        vst1q_s32(lanes, squares);
+        for (int32_t lane : lanes)
+            sumSquares += lane;
+    }
+#endif
+
+    // Whatever did not fill a whole vector
+    for (; x < end; ++x)
+    {
+        int laplacian = laplacianAt(up, row, down, x, x - 1, x + 1);
+        sum += laplacian;
+        sumSquares += laplacian * laplacian;
+    }
+}
+
+// Variance of the Laplacian of an 8-bit single channel image, borders are reflected like OpenCV's BORDER_REFLECT_101
+inline double laplacianVariance(const cv::Mat &gray)
+{
+    CV_Assert(gray.type() == CV_8UC1);
+    const int rows = gray.rows;
+    const int cols = gray.cols;
+    if (rows == 0 || cols == 0)
+        return 0.0;
+
+    int64_t sum = 0;
+    int64_t sumSquares = 0;
+    for (int y = 0; y < rows; ++y)
+    {
+        // Reflecting the row above the first one gives the second one, a single row image is its own neighbour
+        const uint8_t *row = gray.ptr<uint8_t>(y);
+        const uint8_t *up = gray.ptr<uint8_t>(rows == 1 ? 0 : (y == 0 ? 1 : y - 1));
+        const uint8_t *down = gray.ptr<uint8_t>(rows == 1 ? 0 : (y == rows - 1 ? rows - 2 : y + 1));
+
+        if (cols == 1)
+        {
+            int laplacian = laplacianAt(up, row, down, 0, 0, 0);
+            sum += laplacian;
+            sumSquares += laplacian * laplacian;
+            continue;
+        }
+
+        // The first and last pixel reflect their missing neighbour, everything in between goes through the vector loop
+        int first = laplacianAt(up, row, down, 0, 1, 1);
+        int last = laplacianAt(up, row, down, cols - 1, cols - 2, cols - 2);
+        sum += first + last;
+        sumSquares += first * first + last * last;
+        accumulateLaplacianRow(up, row, down, 1, cols - 1, sum, sumSquares);
+    }
+
+    double count = (double)rows * cols;
+    double mean = sum / count;
+    return std::max(0.0, sumSquares / count - mean * mean);
+}
+
+// Sharpness of a BGR (or already gray) crop, gray is scratch space the caller can keep around between calls
+inline double sharpnessScore(const cv::Mat &image, cv::Mat &gray)
+{
+    if (image.channels() == 1)
+        return laplacianVariance(image);
+
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    return laplacianVariance(gray);
+}
+
+#endif
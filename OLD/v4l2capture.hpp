@@ -0,0 +1,304 @@
+// Webcam capture straight through V4L2 memory mapped buffers, an alternative for cv::VideoCapture
+//
+// VideoCapture converts (and so copies) every frame the camera delivers on the capture thread, also the ones the
+// detector skips anyway. Here the capture thread only dequeues a driver buffer and hands out a cv::Mat pointing into it,
+// the conversion to BGR happens on the inference thread for the frames it actually looks at. The buffer goes back to
+// the driver as soon as the last copy of the CapturedFrame holding it is released or overwritten.
+//
+// Trying it without a webcam, the vivid driver makes a virtual one:
+//   sudo modprobe vivid
+//   v4l2-ctl --list-devices              (find the /dev/videoN of "vivid")
+//   v4l2-ctl -d /dev/videoN --list-formats-ext
+// and point CaptureConfig::device in herken.cpp at it with the V4l2Mmap backend.
+
+#ifndef V4L2CAPTURE_HPP
+#define V4L2CAPTURE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A frame as it comes out of a capture backend. image is BGR when pixelFormat is 0, otherwise it is the raw buffer
+// in that V4L2 format. While lease is held the driver buffer image points into is not reused.
+struct CapturedFrame
+{
+    cv::Mat image;
+    uint32_t pixelFormat = 0;
+    std::shared_ptr<void> lease;
+
+    void release()
+    {
+        image.release();
+        lease.reset();
+    }
+};
+
+// Turn a raw frame into BGR, bgr is scratch space the caller keeps around between frames.
+// Returns false for formats it does not know.
+inline bool convertToBgr(const CapturedFrame &frame, cv::Mat &bgr)
+{
+    switch (frame.pixelFormat)
+    {
+    case 0:
+        frame.image.copyTo(bgr);
+        return true;
+    case V4L2_PIX_FMT_YUYV:
+        cv::cvtColor(frame.image, bgr, cv::COLOR_YUV2BGR_YUYV);
+        return true;
+    case V4L2_PIX_FMT_GREY:
+        cv::cvtColor(frame.image, bgr, cv::COLOR_GRAY2BGR);
+        return true;
+    case V4L2_PIX_FMT_MJPEG:
+    case V4L2_PIX_FMT_JPEG:
+        cv::imdecode(frame.image, cv::IMREAD_COLOR, &bgr);
+        return !bgr.empty();
+    default:
+        return false;
+    }
+}
+
+class V4l2MmapCapture
+{
+public:
+    // pixelFormat is a V4L2 fourcc like V4L2_PIX_FMT_YUYV, width, height and fps are what the driver is asked for,
+    // it picks whatever comes closest. bufferCount has to leave the driver a buffer or two next to the frames held by the slot.
+    V4l2MmapCapture(const std::string &device, uint32_t pixelFormat, int width, int height, int fps, int bufferCount)
+        : state(std::make_shared<DeviceState>())
+    {
+        state->fd = open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (state->fd < 0)
+        {
+            std::cerr << "Unable to open " << device << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        struct v4l2_capability capability = {};
+        if (xioctl(VIDIOC_QUERYCAP, &capability) < 0 || !(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+            !(capability.capabilities & V4L2_CAP_STREAMING))
+        {
+            std::cerr << device << " is not a streaming capture device." << std::endl;
+            return;
+        }
+
+        struct v4l2_format format = {};
+        format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        format.fmt.pix.width = width;
+        format.fmt.pix.height = height;
+        format.fmt.pix.pixelformat = pixelFormat;
+        format.fmt.pix.field = V4L2_FIELD_ANY;
+        if (xioctl(VIDIOC_S_FMT, &format) < 0)
+        {
+            std::cerr << "Unable to set the format of " << device << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        // The driver changes the format into what it can actually do
+        frameSize = cv::Size(format.fmt.pix.width, format.fmt.pix.height);
+        bytesPerLine = format.fmt.pix.bytesperline;
+        deliveredFormat = format.fmt.pix.pixelformat;
+
+        if (fps > 0)
+        {
+            struct v4l2_streamparm parameters = {};
+            parameters.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            parameters.parm.capture.timeperframe.numerator = 1;
+            parameters.parm.capture.timeperframe.denominator = fps;
+            xioctl(VIDIOC_S_PARM, &parameters);
+        }
+
+        if (!mapBuffers(bufferCount))
+            return;
+
+        enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(VIDIOC_STREAMON, &type) < 0)
+        {
+            std::cerr << "Unable to start streaming from " << device << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        state->streaming = true;
+        std::cout << "Streaming " << frameSize.width << "x" << frameSize.height << " from " << device << " through "
+                  << state->buffers.size() << " mapped buffers" << std::endl;
+    }
+
+    // Frames still held somewhere keep the mapping alive, it goes away with the last of them
+    ~V4l2MmapCapture()
+    {
+        if (state->streaming)
+        {
+            state->streaming = false;
+            enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            xioctl(VIDIOC_STREAMOFF, &type);
+        }
+    }
+
+    V4l2MmapCapture(const V4l2MmapCapture &) = delete;
+    V4l2MmapCapture &operator=(const V4l2MmapCapture &) = delete;
+
+    bool isOpened() const
+    {
+        return state->streaming;
+    }
+
+    // Set a V4L2 control like V4L2_CID_BRIGHTNESS to its raw value
+    bool setControl(uint32_t id, int value)
+    {
+        struct v4l2_control control = {};
+        control.id = id;
+        control.value = value;
+        return xioctl(VIDIOC_S_CTRL, &control) == 0;
+    }
+
+    // Wait for the next frame and make frame point into its buffer, whatever frame held before is released first.
+    // Returns false when the camera stopped delivering frames.
+    bool read(CapturedFrame &frame)
+    {
+        frame.release();
+        if (!state->streaming)
+            return false;
+
+        struct v4l2_buffer buffer = {};
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        while (xioctl(VIDIOC_DQBUF, &buffer) < 0)
+        {
+            if (errno != EAGAIN)
+            {
+                std::cerr << "Unable to dequeue a frame: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+
+            // Give up on a camera that has not delivered anything for 10 seconds, like VideoCapture does
+            struct pollfd fds = {state->fd, POLLIN, 0};
+            if (poll(&fds, 1, 10000) <= 0)
+            {
+                std::cerr << "Timed out waiting for a frame." << std::endl;
+                return false;
+            }
+        }
+
+        uchar *data = (uchar *)state->buffers[buffer.index].start;
+        switch (deliveredFormat)
+        {
+        case V4L2_PIX_FMT_YUYV:
+            frame.image = cv::Mat(frameSize, CV_8UC2, data, bytesPerLine);
+            break;
+        case V4L2_PIX_FMT_GREY:
+            frame.image = cv::Mat(frameSize, CV_8UC1, data, bytesPerLine);
+            break;
+        default:
+            // Compressed formats, the JPEG is as long as the driver says
+            frame.image = cv::Mat(1, (int)buffer.bytesused, CV_8UC1, data);
+            break;
+        }
+        frame.pixelFormat = deliveredFormat;
+
+        // Give the buffer back to the driver once nobody uses the frame anymore
+        std::shared_ptr<DeviceState> device = state;
+        uint32_t index = buffer.index;
+        frame.lease = std::shared_ptr<void>(data, [device, index](void *)
+                                            { device->requeue(index); });
+        return true;
+    }
+
+private:
+    struct MappedBuffer
+    {
+        void *start;
+        size_t length;
+    };
+
+    // Shared with every lease handed out, so buffers can still be given back after the capture object is gone
+    struct DeviceState
+    {
+        int fd = -1;
+        std::vector<MappedBuffer> buffers;
+        std::atomic<bool> streaming{false};
+
+        void requeue(uint32_t index)
+        {
+            if (!streaming)
+                return;
+            struct v4l2_buffer buffer = {};
+            buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.index = index;
+            if (ioctl(fd, VIDIOC_QBUF, &buffer) < 0)
+            {
+                std::cerr << "Unable to hand buffer " << index << " back to the driver: " << std::strerror(errno) << std::endl;
+            }
+        }
+
+        ~DeviceState()
+        {
+            for (const MappedBuffer &buffer : buffers)
+            {
+                munmap(buffer.start, buffer.length);
+            }
+            if (fd >= 0)
+                close(fd);
+        }
+    };
+
+    std::shared_ptr<DeviceState> state;
+    cv::Size frameSize;
+    size_t bytesPerLine = 0;
+    uint32_t deliveredFormat = 0;
+
+    int xioctl(unsigned long request, void *argument)
+    {
+        int result;
+        do
+        {
+            result = ioctl(state->fd, request, argument);
+        } while (result < 0 && errno == EINTR);
+        return result;
+    }
+
+    bool mapBuffers(int bufferCount)
+    {
+        struct v4l2_requestbuffers request = {};
+        request.count = bufferCount;
+        request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        request.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(VIDIOC_REQBUFS, &request) < 0 || request.count < 2)
+        {
+            std::cerr << "Unable to get mmap buffers from the driver: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        for (uint32_t i = 0; i < request.count; ++i)
+        {
+            struct v4l2_buffer buffer = {};
+            buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.index = i;
+            if (xioctl(VIDIOC_QUERYBUF, &buffer) < 0)
+                return false;
+
+            void *start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, buffer.m.offset);
+            if (start == MAP_FAILED)
+            {
+                std::cerr << "Unable to map buffer " << i << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            state->buffers.push_back({start, buffer.length});
+
+            if (xioctl(VIDIOC_QBUF, &buffer) < 0)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,240 @@
+// Post-processing of YOLO output tensors, shared by herken.cpp and benchdecode.cpp
+//
+// Darknet hands back one row per anchor: [centerX, centerY, width, height, objectness, class scores...].
+// YOLOv8 exports the transposed layout [1, 4 + classes, anchors], so there every value of a kind is contiguous.
+// Nearly all anchors are background, so the score column/row is scanned in bulk first with whatever
+// vector unit the build targets (AVX2 / SSE2 on dev boxes, NEON on the Pi) and only the surviving
+// anchors are decoded into boxes.
+
+#ifndef YOLODECODE_HPP
+#define YOLODECODE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define YOLODECODE_SIMD "AVX2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YOLODECODE_SIMD "SSE2"
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YOLODECODE_SIMD "NEON"
+#else
+#define YOLODECODE_SIMD "scalar"
+#endif
+
+#ifndef EXPANSIONPIXELS
+#define EXPANSIONPIXELS 50
+#endif
+
+// Where the frame ended up inside the letterboxed network input, needed to map boxes back to frame coordinates
+struct LetterboxInfo
+{
+    cv::Size inputSize;
+    float scale;
+    int padX;
+    int padY;
+};
+
+// Column holding the objectness score in a Darknet output row
+constexpr int OBJECTNESSCOLUMN = 4;
+
+// Write the indices of all rows whose objectness is above threshold into survivors (room for rows entries needed),
+// returns how many there are
+inline size_t scanObjectness(const float *data, int rows, int cols, float threshold, int *survivors)
+{
+    const float *objectness = data + OBJECTNESSCOLUMN;
+    size_t count = 0;
+    int row = 0;
+
+#if defined(__AVX2__)
+    // Gather 8 rows worth of objectness per step, the common all-background case is a single compare and branch
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(cols));
+    const __m256 limit = _mm256_set1_ps(threshold);
+    for (; row + 8 <= rows; row += 8)
+    {
+        __m256 scores = _mm256_i32gather_ps(objectness + (size_t)row * cols, offsets, 4);
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(scores, limit, _CMP_GT_OQ));
+        while (mask)
+        {
+            survivors[count++] = row + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128 limit = _mm_set1_ps(threshold);
+    for (; row + 4 <= rows; row += 4)
+    {
+        const float *base = objectness + (size_t)row * cols;
+        __m128 scores = _mm_setr_ps(base[0], base[cols], base[2 * cols], base[3 * cols]);
+        unsigned mask = (unsigned)_mm_movemask_ps(_mm_cmpgt_ps(scores, limit));
+        while (mask)
+        {
+            survivors[count++] = row + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t limit = vdupq_n_f32(threshold);
+    for (; row + 4 <= rows; row += 4)
+    {
+        const float *base = objectness + (size_t)row * cols;
+        float32x4_t scores = vdupq_n_f32(base[0]);
+        scores = vld1q_lane_f32(base + cols, scores, 1);
+        scores = vld1q_lane_f32(base + 2 * cols, scores, 2);
+        scores = vld1q_lane_f32(base + 3 * cols, scores, 3);
+        uint32x4_t above = vcgtq_f32(scores, limit);
+
+        // Fold the four lanes into one, pairwise max also exists on the 32 bit Pi OS
+        uint32x2_t folded = vpmax_u32(vget_low_u32(above), vget_high_u32(above));
+        if (vget_lane_u32(vpmax_u32(folded, folded), 0) == 0)
+            continue;
+
+        uint32_t lanes[4];
+        vst1q_u32(lanes, above);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if (lanes[lane])
+                survivors[count++] = row + lane;
+        }
+    }
+#endif
+
+    // Rows left over after the last full vector, or everything on the scalar build
+    for (; row < rows; ++row)
+    {
+        if (objectness[(size_t)row * cols] > threshold)
+            survivors[count++] = row;
+    }
+    return count;
+}
+
+// Write the indices of all contiguous scores above threshold into survivors (room for count entries needed),
+// returns how many there are
+inline size_t scanScores(const float *scores, int count, float threshold, int *survivors)
+{
+    size_t found = 0;
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256 limit = _mm256_set1_ps(threshold);
+    for (; i + 8 <= count; i += 8)
+    {
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(scores + i), limit, _CMP_GT_OQ));
+        while (mask)
+        {
+            survivors[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128 limit = _mm_set1_ps(threshold);
+    for (; i + 4 <= count; i += 4)
+    {
+        unsigned mask = (unsigned)_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(scores + i), limit));
+        while (mask)
+        {
+            survivors[found++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t limit = vdupq_n_f32(threshold);
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t above = vcgtq_f32(vld1q_f32(scores + i), limit);
+        uint32x2_t folded = vpmax_u32(vget_low_u32(above), vget_high_u32(above));
+        if (vget_lane_u32(vpmax_u32(folded, folded), 0) == 0)
+            continue;
+
+        uint32_t lanes[4];
+        vst1q_u32(lanes, above);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if (lanes[lane])
+                survivors[found++] = i + lane;
+        }
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        if (scores[i] > threshold)
+            survivors[found++] = i;
+    }
+    return found;
+}
+
+// Turn a box in frame coordinates into the EXPANSIONPIXELS grown rectangle herken.cpp crops, kept inside the frame
+inline cv::Rect expandBox(int centerX, int centerY, int width, int height, cv::Size frameSize)
+{
+    int left = std::max(0, centerX - width / 2 - EXPANSIONPIXELS);
+    int top = std::max(0, centerY - height / 2 - EXPANSIONPIXELS);
+    width = std::min(frameSize.width - left, width + 2 * EXPANSIONPIXELS);
+    height = std::min(frameSize.height - top, height + 2 * EXPANSIONPIXELS);
+    return cv::Rect(left, top, width, height);
+}
+
+// 2D view of one image's part of a batched output, a batch of one may come without the batch dimension.
+// Darknet gives [batch, rows, columns] for more than one image, YOLOv8 always [batch, 4 + classes, anchors].
+inline cv::Mat batchItem(const cv::Mat &out, int item)
+{
+    if (out.dims < 3)
+        return out;
+    return cv::Mat(out.size[1], out.size[2], CV_32F, (void *)out.ptr<float>(item));
+}
+
+// Decode the rows of a Darknet YOLO output whose objectness is above the threshold into frame boxes grown by EXPANSIONPIXELS.
+// Boxes and confidences are appended, survivors is scratch space the caller keeps around between frames.
+inline void decodeDarknetOutput(const cv::Mat &out, const LetterboxInfo &letterbox, cv::Size frameSize, float confidenceThreshold,
+                                std::vector<int> &survivors, std::vector<cv::Rect> &boxes, std::vector<float> &confidences)
+{
+    const float *data = (const float *)out.data;
+    const int cols = out.cols;
+    survivors.resize(std::max<size_t>(survivors.size(), (size_t)out.rows));
+    size_t count = scanObjectness(data, out.rows, cols, confidenceThreshold, survivors.data());
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float *row = data + (size_t)survivors[i] * cols;
+
+        // The box is relative to the letterboxed input, undo the padding and scaling to get frame coordinates
+        int centerX = (int)((row[0] * letterbox.inputSize.width - letterbox.padX) / letterbox.scale);
+        int centerY = (int)((row[1] * letterbox.inputSize.height - letterbox.padY) / letterbox.scale);
+        int width = (int)(row[2] * letterbox.inputSize.width / letterbox.scale);
+        int height = (int)(row[3] * letterbox.inputSize.height / letterbox.scale);
+
+        confidences.push_back(row[OBJECTNESSCOLUMN]);
+        boxes.push_back(expandBox(centerX, centerY, width, height, frameSize));
+    }
+}
+
+// Decode a YOLOv8 output ([1, 4 + classes, anchors], box in input pixels) of a single class face model the same way.
+// Anything after the face score (landmarks) is ignored.
+inline void decodeYolov8Output(const cv::Mat &out, const LetterboxInfo &letterbox, cv::Size frameSize, float confidenceThreshold,
+                               std::vector<int> &survivors, std::vector<cv::Rect> &boxes, std::vector<float> &confidences)
+{
+    // Depending on the exporter the batch dimension is there or not
+    const int anchors = out.dims == 3 ? out.size[2] : out.cols;
+    const float *data = (const float *)out.data;
+    const float *scores = data + 4 * (size_t)anchors;
+    survivors.resize(std::max<size_t>(survivors.size(), (size_t)anchors));
+    size_t count = scanScores(scores, anchors, confidenceThreshold, survivors.data());
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int anchor = survivors[i];
+        int centerX = (int)((data[anchor] - letterbox.padX) / letterbox.scale);
+        int centerY = (int)((data[anchors + anchor] - letterbox.padY) / letterbox.scale);
+        int width = (int)(data[2 * (size_t)anchors + anchor] / letterbox.scale);
+        int height = (int)(data[3 * (size_t)anchors + anchor] / letterbox.scale);
+
+        confidences.push_back(scores[anchor]);
+        boxes.push_back(expandBox(centerX, centerY, width, height, frameSize));
+    }
+}
+
+#endif